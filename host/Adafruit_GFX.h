@@ -0,0 +1,38 @@
+/*
+ * Host stand-in for the Adafruit GFX core library.
+ *
+ * Text is accepted and tracked by cursor only; nothing is rasterized.
+ */
+
+#ifndef _HOST_ADAFRUIT_GFX_H
+#define _HOST_ADAFRUIT_GFX_H
+
+#include "Arduino.h"
+
+class Adafruit_GFX {
+  public:
+    Adafruit_GFX(int16_t w, int16_t h);
+    virtual ~Adafruit_GFX() {}
+
+    virtual void drawPixel(int16_t x, int16_t y, uint16_t color) = 0;
+    virtual void fillRect(int16_t x, int16_t y, int16_t w, int16_t h,
+        uint16_t color);
+    virtual void fillScreen(uint16_t color);
+
+    void setCursor(int16_t x, int16_t y);
+    void setTextColor(uint16_t c);
+    void setTextColor(uint16_t c, uint16_t bg);
+    size_t print(const char *s);
+    size_t print(const __FlashStringHelper *s);
+    size_t print(char c);
+
+    int16_t width() { return _width; }
+    int16_t height() { return _height; }
+
+  protected:
+    int16_t _width, _height;
+    int16_t cursor_x, cursor_y;
+    uint16_t textcolor, textbgcolor;
+};
+
+#endif
@@ -0,0 +1,45 @@
+/*
+ * Host stand-in for the Adafruit ST7735 driver.
+ *
+ * The panel is a 128x160 RGB565 frame buffer in memory.  setAddrWindow and
+ * pushColor behave like the real controller's RAM write window.  Every call
+ * also counts the bytes the real driver would clock out over SPI.
+ */
+
+#ifndef _HOST_ADAFRUIT_ST7735_H
+#define _HOST_ADAFRUIT_ST7735_H
+
+#include "Adafruit_GFX.h"
+
+#define INITR_GREENTAB 0x0
+#define INITR_REDTAB   0x1
+#define INITR_BLACKTAB 0x2
+
+#define ST7735_TFTWIDTH  128
+#define ST7735_TFTHEIGHT 160
+
+class Adafruit_ST7735 : public Adafruit_GFX {
+  public:
+    Adafruit_ST7735(uint8_t cs, uint8_t rs, uint8_t rst);
+
+    void initR(uint8_t options = INITR_GREENTAB);
+    void setAddrWindow(uint8_t x0, uint8_t y0, uint8_t x1, uint8_t y1);
+    void pushColor(uint16_t color);
+    void drawPixel(int16_t x, int16_t y, uint16_t color);
+    void fillRect(int16_t x, int16_t y, int16_t w, int16_t h,
+        uint16_t color);
+
+    // host only: read back the frame buffer
+    uint16_t getPixel(int16_t x, int16_t y);
+
+    // host only: bytes sent over SPI so far, commands and data
+    uint32_t getSpiBytes() { return spiBytes; }
+
+  private:
+    uint16_t fb[ST7735_TFTHEIGHT][ST7735_TFTWIDTH];
+    uint8_t winX0, winY0, winX1, winY1;
+    uint8_t curX, curY;
+    uint32_t spiBytes;
+};
+
+#endif
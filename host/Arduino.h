@@ -0,0 +1,139 @@
+/*
+ * Host stand-in for the Arduino core, used by `make host`.
+ *
+ * Only the pieces snake.cpp touches are provided.  Everything is backed by
+ * memory or by a socket to the peer process, so the game logic can be run
+ * and timed on a Linux box.  See host/hal.cpp for the behaviour of each
+ * stand-in.
+ */
+
+#ifndef _HOST_ARDUINO_H
+#define _HOST_ARDUINO_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+
+#define DEC 10
+#define HEX 16
+
+#ifndef min
+#define min(a,b) ((a)<(b)?(a):(b))
+#endif
+#ifndef max
+#define max(a,b) ((a)>(b)?(a):(b))
+#endif
+
+/* Program memory.  The host has only the one address space, so flash data
+ * is ordinary data and reading it is a plain load.
+ */
+#define PROGMEM
+#define pgm_read_byte(p) (*(const uint8_t *)(p))
+#define pgm_read_word(p) (*(const uint16_t *)(p))
+#define pgm_read_dword(p) (*(const uint32_t *)(p))
+class __FlashStringHelper;
+#define F(s) (reinterpret_cast<const __FlashStringHelper *>(s))
+
+/* Clock.  Time moves forward by real elapsed time plus whatever is "slept"
+ * in delay(), which returns immediately, so idle waits cost nothing.  The
+ * server and client processes keep their clocks within a few ms of each
+ * other.
+ */
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+/* Pins.  The joystick axes and button are driven by a seeded random bot and
+ * pin 11 reads HIGH on the server process.
+ */
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+int digitalRead(uint8_t pin);
+int analogRead(uint8_t pin);
+
+/* Forks a process for each client and links it to the server over a
+ * pseudo-terminal. */
+void init();
+
+// bytes in each port's receive and transmit rings, as in the AVR core;
+// each holds one less
+#define SERIAL_RX_BUFFER_SIZE 64
+#define SERIAL_TX_BUFFER_SIZE 64
+
+class HardwareSerial {
+  public:
+    HardwareSerial(int port);
+    void begin(unsigned long baud);
+    void end();
+    int available();
+    int peek();
+    int read();
+    int availableForWrite();
+    void flush();
+    size_t write(uint8_t b);
+    size_t write(const uint8_t *buf, size_t n);
+    size_t print(const char *s);
+    size_t print(const __FlashStringHelper *s);
+    size_t print(char c);
+    size_t print(int n, int base = DEC);
+    size_t print(unsigned int n, int base = DEC);
+    size_t print(long n, int base = DEC);
+    size_t print(unsigned long n, int base = DEC);
+    size_t println();
+    size_t println(const char *s);
+    size_t println(const __FlashStringHelper *s);
+    size_t println(char c);
+    size_t println(int n, int base = DEC);
+    size_t println(unsigned int n, int base = DEC);
+    size_t println(long n, int base = DEC);
+    size_t println(unsigned long n, int base = DEC);
+
+    // host only: attach the port to a file descriptor, as side 0 (the
+    // server's) or side 1 (the client's) of link
+    void attach(int fd, int link, int side);
+
+  private:
+    int port;
+    int fd;
+    int link;
+    int side;
+    unsigned long baud;
+    int peeked;
+    uint8_t rx[SERIAL_RX_BUFFER_SIZE];
+    uint8_t rxHead;
+    uint8_t rxTail;
+    void fill();
+};
+
+extern HardwareSerial Serial;
+extern HardwareSerial Serial1;
+extern HardwareSerial Serial2;
+extern HardwareSerial Serial3;
+
+/* Host only: true in the process playing the server. */
+extern bool hostIsServer;
+
+/* Host only: 0 in the server, n in the process playing client n. */
+extern uint8_t hostBoard;
+
+/* Host only: "server", "client", "client2" or "client3". */
+const char *hostName();
+
+/* Host only: prints how many game ticks ran and the real time they took. */
+void hostReport(uint32_t ticks);
+
+/* Host only: prints one named measurement. */
+void hostStat(const char *name, double value);
+
+#endif
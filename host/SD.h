@@ -0,0 +1,108 @@
+/*
+ * Host stand-in for the Arduino SD library.
+ *
+ * SD.open() loads the named file from the host file system into memory, so
+ * reads and seeks are plain memory copies.  A file opened with FILE_WRITE
+ * is appended to on the host file system instead.  The utility layer's
+ * SdFile reads and writes host files directly.
+ */
+
+#ifndef _HOST_SD_H
+#define _HOST_SD_H
+
+#include "Arduino.h"
+
+#include <stdio.h>
+
+#define FILE_READ 0x01
+#define FILE_WRITE 0x13
+
+class File {
+  public:
+    File();
+    File(uint8_t *data, uint32_t size);
+
+    int read();
+    int read(void *buf, uint16_t nbyte);
+    size_t write(uint8_t b);
+    size_t write(const uint8_t *buf, size_t size);
+    void flush();
+    boolean seek(uint32_t pos);
+    uint32_t position();
+    uint32_t size();
+    int available();
+    void close();
+    operator bool();
+
+  private:
+    friend class SDClass;
+    uint8_t *data;
+    uint32_t len;
+    uint32_t pos;
+    FILE *out; // set when opened for writing
+};
+
+class SDClass {
+  public:
+    boolean begin(uint8_t csPin);
+    File open(const char *filepath, uint8_t mode = FILE_READ);
+    boolean exists(const char *filepath);
+    boolean remove(const char *filepath);
+
+    // host only: card traffic so far, for benchmarks
+    uint32_t reads;
+    uint32_t seeks;
+    uint32_t bytesRead;
+    uint32_t writes;
+    uint32_t bytesWritten;
+};
+
+extern SDClass SD;
+
+// The SD library's utility layer, which SDClass and File are built on: a
+// card, the FAT volume on it and files in the volume, all of which a
+// sketch can keep in static storage.  An SdFile here is a host file in the
+// current directory, the root the only directory.
+
+#define SPI_FULL_SPEED 0
+#define SPI_HALF_SPEED 1
+#define SPI_QUARTER_SPEED 2
+
+// SdFile::open() flags, as in the library
+#define O_READ 0x01
+#define O_RDONLY O_READ
+#define O_WRITE 0x02
+#define O_WRONLY O_WRITE
+#define O_RDWR (O_READ | O_WRITE)
+#define O_APPEND 0x04
+#define O_CREAT 0x10
+#define O_EXCL 0x20
+#define O_TRUNC 0x40
+
+class Sd2Card {
+  public:
+    uint8_t init(uint8_t sckRateID, uint8_t chipSelectPin);
+};
+
+class SdVolume {
+  public:
+    uint8_t init(Sd2Card *dev);
+};
+
+class SdFile {
+  public:
+    SdFile();
+    uint8_t openRoot(SdVolume *vol);
+    uint8_t open(SdFile *dirFile, const char *fileName, uint8_t oflag);
+    uint8_t isOpen();
+    int16_t read(void *buf, uint16_t nbyte);
+    int16_t write(const void *buf, uint16_t nbyte);
+    uint8_t close();
+    static uint8_t remove(SdFile *dirFile, const char *fileName);
+
+  private:
+    bool root;
+    FILE *f;
+};
+
+#endif
@@ -0,0 +1 @@
+/* Host stand-in: the display is simulated in memory, there is no SPI bus. */
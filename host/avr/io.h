@@ -0,0 +1,9 @@
+/* Host stand-in for <avr/io.h>, just enough for mem_syms.h to parse. */
+
+#ifndef _HOST_AVR_IO_H
+#define _HOST_AVR_IO_H
+
+#define RAMEND 0x21FF
+#define AVR_STACK_POINTER_REG 0
+
+#endif
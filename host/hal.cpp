@@ -0,0 +1,475 @@
+/*
+ * Host implementations of the Arduino core stand-ins declared in Arduino.h.
+ */
+
+#include <stdio.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <termios.h>
+
+#include "Arduino.h"
+
+// clients the server plays with, one process each; the sketch is built
+// with the same CLIENTS
+#ifndef CLIENTS
+#define CLIENTS 1
+#endif
+#define BOARDS (CLIENTS + 1)
+
+bool hostIsServer = true;
+uint8_t hostBoard = 0;
+
+HardwareSerial Serial(0);
+HardwareSerial Serial1(1);
+HardwareSerial Serial2(2);
+HardwareSerial Serial3(3);
+
+// the server's port to each client, wired as on the boards
+static HardwareSerial *const client_ports[3] = {&Serial2, &Serial3, &Serial1};
+
+/* ---- clock ---- */
+
+// Each process keeps a virtual clock: the real time it spent running plus
+// every delay it skipped.  Time spent waiting on its peers is not counted.
+// The clocks are published in shared memory and a process that gets more
+// than a couple of milliseconds ahead of the slowest other board waits for
+// it in delay(), so timeouts and frame rates line up as they would on real
+// boards.
+#define CLOCK_SLACK_US 2000
+#define PEER_GIVEUP_US 1000000
+
+struct SharedClock {
+  volatile uint64_t now[BOARDS];
+  volatile int gone[BOARDS];
+};
+
+static SharedClock local_clock;
+static SharedClock *shared = &local_clock;
+static int self = 0;
+static bool has_peer = false;
+
+// The rate each end of each link is set to, so that a byte sent at one
+// rate and received at another arrives garbled, as it would on a UART.
+// SNEK_WIRE_BAUD=n makes the wire itself unreliable above n baud.
+struct SharedWire {
+  volatile unsigned long baud[CLIENTS][2];
+};
+
+static SharedWire local_wire;
+static SharedWire *wire = &local_wire;
+static unsigned long wire_limit = 0;
+static uint32_t noise_state = 1;
+
+static uint64_t skipped_us = 0;
+static uint64_t waited_us = 0;
+static struct timespec epoch;
+
+static uint64_t real_us() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)(now.tv_sec - epoch.tv_sec) * 1000000 +
+    (now.tv_nsec - epoch.tv_nsec) / 1000;
+}
+
+static uint64_t virtual_us() {
+  uint64_t now = real_us() - waited_us + skipped_us;
+  shared->now[self] = now;
+  return now;
+}
+
+// the board furthest behind that is still running, or -1
+static int slowest_peer() {
+  int slowest = -1;
+  for (int b = 0; b < BOARDS; b++) {
+    if (b == self || shared->gone[b]) continue;
+    if (slowest < 0 || shared->now[b] < shared->now[slowest]) slowest = b;
+  }
+  return slowest;
+}
+
+static void sync_peer() {
+  if (!has_peer) return;
+  uint64_t start = real_us();
+  int peer;
+  while ((peer = slowest_peer()) >= 0
+      && virtual_us() > shared->now[peer] + CLOCK_SLACK_US) {
+    sched_yield();
+    uint64_t waited = real_us() - start;
+    if (waited > PEER_GIVEUP_US) {
+      shared->gone[peer] = 1; // peer hung or crashed, run on without it
+    }
+    waited_us += waited;
+    start += waited;
+  }
+}
+
+static void leave_clock() {
+  shared->gone[self] = 1;
+}
+
+unsigned long micros() {
+  return (unsigned long)virtual_us();
+}
+
+unsigned long millis() {
+  return (unsigned long)(virtual_us() / 1000);
+}
+
+// waits are skipped rather than slept, the clock just jumps ahead
+void delay(unsigned long ms) {
+  skipped_us += (uint64_t)ms * 1000;
+  sync_peer();
+}
+
+void delayMicroseconds(unsigned int us) {
+  skipped_us += us;
+  sync_peer();
+}
+
+/* ---- pins ---- */
+
+// joystick wiring used by snake.cpp
+#define PIN_VERT 0
+#define PIN_HOR  1
+#define PIN_SEL  9
+#define PIN_ROLE 11
+
+static uint32_t rng_state = 1;
+
+static uint32_t rng() {
+  // xorshift32
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 17;
+  rng_state ^= rng_state << 5;
+  return rng_state;
+}
+
+// the bot holds the stick in one position for a while, then picks another
+static unsigned long bot_until = 0;
+static int bot_vert = 512;
+static int bot_hor = 512;
+static bool bot_button = false;
+
+static void bot_step() {
+  unsigned long now = millis();
+  if (now < bot_until) return;
+  bot_until = now + 100 + rng() % 500;
+  bot_vert = bot_hor = 512;
+  switch (rng() % 6) {
+    case 0: bot_vert = 0; break;
+    case 1: bot_vert = 1023; break;
+    case 2: bot_hor = 0; break;
+    case 3: bot_hor = 1023; break;
+    default: break; // centred
+  }
+  bot_button = rng() % 8 == 0;
+}
+
+void pinMode(uint8_t pin, uint8_t mode) {}
+
+void digitalWrite(uint8_t pin, uint8_t val) {}
+
+int digitalRead(uint8_t pin) {
+  if (pin == PIN_ROLE) return hostIsServer ? HIGH : LOW;
+  if (pin == PIN_SEL) {
+    bot_step();
+    return bot_button ? LOW : HIGH; // active low
+  }
+  return LOW;
+}
+
+int analogRead(uint8_t pin) {
+  // the first reads are the joystick baseline, so start centred
+  if (bot_until == 0) {
+    bot_until = millis() + 100;
+    return 512;
+  }
+  bot_step();
+  if (pin == PIN_VERT) return bot_vert;
+  if (pin == PIN_HOR) return bot_hor;
+  return 0;
+}
+
+/* ---- process setup ---- */
+
+static pid_t peer_pids[CLIENTS];
+
+static void reap_peer() {
+  leave_clock();
+  for (int c = 0; c < CLIENTS; c++) {
+    if (peer_pids[c] > 0) waitpid(peer_pids[c], NULL, 0);
+  }
+}
+
+// Opens a pseudo-terminal in raw mode, so bytes pass through it untouched
+// the way they would over a serial cable.  The master end is the server's
+// side of the link, the slave end the client's.
+static void open_link(int fds[2]) {
+  fds[0] = posix_openpt(O_RDWR | O_NOCTTY);
+  if (fds[0] < 0 || grantpt(fds[0]) < 0 || unlockpt(fds[0]) < 0) {
+    perror("posix_openpt");
+    exit(1);
+  }
+  fds[1] = open(ptsname(fds[0]), O_RDWR | O_NOCTTY);
+  if (fds[1] < 0) {
+    perror("ptsname");
+    exit(1);
+  }
+  struct termios raw;
+  tcgetattr(fds[1], &raw);
+  cfmakeraw(&raw);
+  tcsetattr(fds[1], TCSANOW, &raw);
+}
+
+// The server is this process and each client is a forked copy of it.  The
+// server talks to its clients on Serial2, Serial3 and Serial1 in that
+// order, and every client talks to the server on its own Serial2; each of
+// those links is a pseudo-terminal.  SNEK_SEED picks the bot moves.
+void init() {
+  clock_gettime(CLOCK_MONOTONIC, &epoch);
+  signal(SIGPIPE, SIG_IGN);
+
+  // a replay is played by the server on its own, as fast as it runs, and
+  // the benchmarks need no clients either
+  int clients = getenv("SNEK_REPLAY") || getenv("SNEK_BENCH") ? 0 : CLIENTS;
+  // a link left unopened stays -1 on both ends
+  int links[CLIENTS][2];
+  for (int c = 0; c < CLIENTS; c++) {
+    links[c][0] = links[c][1] = -1;
+    if (c < clients) open_link(links[c]);
+  }
+  void *mem = mmap(NULL, sizeof(SharedClock), PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (mem == MAP_FAILED) {
+    perror("mmap");
+    exit(1);
+  }
+  shared = (SharedClock *)mem;
+  memset(mem, 0, sizeof(SharedClock));
+  mem = mmap(NULL, sizeof(SharedWire), PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (mem == MAP_FAILED) {
+    perror("mmap");
+    exit(1);
+  }
+  wire = (SharedWire *)mem;
+  memset(mem, 0, sizeof(SharedWire));
+
+  fflush(stdout);
+  for (int c = 0; c < clients && hostIsServer; c++) {
+    peer_pids[c] = fork();
+    if (peer_pids[c] < 0) {
+      perror("fork");
+      exit(1);
+    }
+    if (!peer_pids[c]) {
+      hostIsServer = false;
+      hostBoard = c + 1;
+    }
+  }
+  self = hostBoard;
+  has_peer = clients > 0;
+  for (int c = 0; c < clients; c++) {
+    if (hostIsServer) {
+      client_ports[c]->attach(links[c][0], c, 0);
+    } else if (hostBoard == c + 1) {
+      Serial2.attach(links[c][1], c, 1);
+    }
+    if (hostIsServer || hostBoard != c + 1) close(links[c][1]);
+    if (!hostIsServer) close(links[c][0]);
+  }
+  atexit(hostIsServer ? reap_peer : leave_clock);
+
+  const char *seed = getenv("SNEK_SEED");
+  rng_state = (seed ? strtoul(seed, NULL, 10) : 1) * BOARDS + 1 + hostBoard;
+  rng_state = rng_state ? rng_state : 1;
+  // the line noise has its own generator so it leaves the bot's moves be
+  noise_state = rng_state * 2654435761u | 1;
+  const char *limit = getenv("SNEK_WIRE_BAUD");
+  wire_limit = limit ? strtoul(limit, NULL, 10) : 0;
+}
+
+/* ---- serial ---- */
+
+// Serial (port 0) is the debug console and only reaches stdout when
+// SNEK_SERIAL is set; other ports need attach().
+HardwareSerial::HardwareSerial(int p)
+  : port(p), fd(-1), link(-1), side(0), baud(0), peeked(-1), rxHead(0),
+    rxTail(0) {}
+
+void HardwareSerial::attach(int f, int l, int s) {
+  fd = f;
+  link = l;
+  side = s;
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+  if (baud) wire->baud[link][side] = baud;
+}
+
+void HardwareSerial::begin(unsigned long rate) {
+  if (port == 0 && fd < 0 && getenv("SNEK_SERIAL")) fd = 1;
+  baud = rate;
+  if (link >= 0) wire->baud[link][side] = rate;
+}
+
+void HardwareSerial::end() {}
+
+// pull whatever the peer has sent into the 64 byte receive ring; anything
+// that does not fit stays queued in the link.  Delays are skipped, so a
+// peer can time out and resend far faster than a real UART could deliver,
+// and dropping the excess here would lose bytes the hardware never would.
+void HardwareSerial::fill() {
+  if (fd < 0 || port == 0) return;
+  uint8_t buf[sizeof(rx)];
+  ssize_t n = ::read(fd, buf, sizeof(rx) - 1 - (uint8_t)(rxHead - rxTail));
+  for (ssize_t i = 0; i < n; i++) {
+    rx[rxHead++ % sizeof(rx)] = buf[i];
+  }
+}
+
+int HardwareSerial::available() {
+  fill();
+  return (uint8_t)(rxHead - rxTail);
+}
+
+int HardwareSerial::peek() {
+  if (!available()) return -1;
+  return rx[rxTail % sizeof(rx)];
+}
+
+int HardwareSerial::read() {
+  if (!available()) return -1;
+  return rx[rxTail++ % sizeof(rx)];
+}
+
+// writes go straight out, so the transmit ring is always empty
+int HardwareSerial::availableForWrite() {
+  return SERIAL_TX_BUFFER_SIZE - 1;
+}
+
+void HardwareSerial::flush() {}
+
+size_t HardwareSerial::write(uint8_t b) {
+  return write(&b, 1);
+}
+
+static uint32_t noise() {
+  noise_state ^= noise_state << 13;
+  noise_state ^= noise_state >> 17;
+  noise_state ^= noise_state << 5;
+  return noise_state;
+}
+
+size_t HardwareSerial::write(const uint8_t *buf, size_t n) {
+  if (fd < 0) return n;
+  uint8_t sent[256];
+  if (link >= 0) {
+    // the far end reads bytes sent at another rate as noise, and a wire
+    // pushed past its limit flips a bit in about one byte in 64
+    bool mismatched = wire->baud[link][!side] != baud;
+    bool noisy = wire_limit && baud > wire_limit;
+    if (n > sizeof(sent)) n = sizeof(sent);
+    for (size_t i = 0; i < n; i++) {
+      sent[i] = buf[i];
+      if (mismatched) {
+        sent[i] = noise();
+      } else if (noisy && noise() % 64 == 0) {
+        sent[i] ^= 1 << noise() % 8;
+      }
+    }
+    buf = sent;
+  }
+  // a full or closed link drops bytes, same as a disconnected wire
+  ssize_t w = ::write(fd, buf, n);
+  return w < 0 ? 0 : w;
+}
+
+size_t HardwareSerial::print(const char *s) {
+  return write((const uint8_t *)s, strlen(s));
+}
+
+size_t HardwareSerial::print(const __FlashStringHelper *s) {
+  return print(reinterpret_cast<const char *>(s));
+}
+
+size_t HardwareSerial::print(char c) {
+  return write((uint8_t)c);
+}
+
+size_t HardwareSerial::print(long n, int base) {
+  char buf[24];
+  snprintf(buf, sizeof(buf), base == HEX ? "%lx" : "%ld", n);
+  return print(buf);
+}
+
+size_t HardwareSerial::print(unsigned long n, int base) {
+  char buf[24];
+  snprintf(buf, sizeof(buf), base == HEX ? "%lx" : "%lu", n);
+  return print(buf);
+}
+
+size_t HardwareSerial::print(int n, int base) {
+  return print((long)n, base);
+}
+
+size_t HardwareSerial::print(unsigned int n, int base) {
+  return print((unsigned long)n, base);
+}
+
+size_t HardwareSerial::println() {
+  return print("\r\n");
+}
+
+size_t HardwareSerial::println(const char *s) {
+  return print(s) + println();
+}
+
+size_t HardwareSerial::println(const __FlashStringHelper *s) {
+  return print(s) + println();
+}
+
+size_t HardwareSerial::println(char c) {
+  return print(c) + println();
+}
+
+size_t HardwareSerial::println(int n, int base) {
+  return print(n, base) + println();
+}
+
+size_t HardwareSerial::println(unsigned int n, int base) {
+  return print(n, base) + println();
+}
+
+size_t HardwareSerial::println(long n, int base) {
+  return print(n, base) + println();
+}
+
+size_t HardwareSerial::println(unsigned long n, int base) {
+  return print(n, base) + println();
+}
+
+/* ---- reporting ---- */
+
+const char *hostName() {
+  static const char *const names[] = {"server", "client", "client2", "client3"};
+  return names[hostBoard];
+}
+
+// real time excludes everything skipped by delay() and spent waiting on the
+// peer, so this is the cost of the game logic plus the stand-ins
+void hostReport(uint32_t ticks) {
+  uint64_t us = real_us() - waited_us;
+  printf("[%s] %lu ticks in %.3f ms, %.0f ticks/sec\n",
+      hostName(), (unsigned long)ticks, us / 1000.0,
+      us ? ticks * 1e6 / us : 0.0);
+  fflush(stdout);
+}
+
+void hostStat(const char *name, double value) {
+  printf("[%s]   %s: %.2f\n", hostName(), name, value);
+  fflush(stdout);
+}
@@ -0,0 +1,169 @@
+/*
+ * Host implementations of the SD library stand-ins.
+ */
+
+#include <stdio.h>
+
+#include "SD.h"
+
+SDClass SD;
+
+File::File() : data(NULL), len(0), pos(0), out(NULL) {}
+
+File::File(uint8_t *d, uint32_t size) : data(d), len(size), pos(0), out(NULL) {}
+
+int File::read() {
+  if (pos >= len) return -1;
+  SD.reads++;
+  SD.bytesRead++;
+  return data[pos++];
+}
+
+int File::read(void *buf, uint16_t nbyte) {
+  if (!data) return -1;
+  uint32_t n = min((uint32_t)nbyte, len - pos);
+  memcpy(buf, data + pos, n);
+  pos += n;
+  SD.reads++;
+  SD.bytesRead += n;
+  return n;
+}
+
+boolean File::seek(uint32_t p) {
+  SD.seeks++;
+  if (p > len) return false;
+  pos = p;
+  return true;
+}
+
+size_t File::write(uint8_t b) {
+  return write(&b, 1);
+}
+
+size_t File::write(const uint8_t *buf, size_t size) {
+  if (!out) return 0;
+  SD.writes++;
+  SD.bytesWritten += size;
+  return fwrite(buf, 1, size, out);
+}
+
+void File::flush() {
+  if (out) fflush(out);
+}
+
+uint32_t File::position() {
+  return pos;
+}
+
+uint32_t File::size() {
+  return len;
+}
+
+int File::available() {
+  return len - pos;
+}
+
+void File::close() {
+  if (out) fclose(out);
+  out = NULL;
+  free(data);
+  data = NULL;
+  len = pos = 0;
+}
+
+File::operator bool() {
+  return data != NULL || out != NULL;
+}
+
+boolean SDClass::begin(uint8_t csPin) {
+  return true;
+}
+
+// the whole file is read up front, the card is the host's current directory
+File SDClass::open(const char *filepath, uint8_t mode) {
+  if (mode == FILE_WRITE) {
+    File file;
+    file.out = fopen(filepath, "ab");
+    return file;
+  }
+  FILE *f = fopen(filepath, "rb");
+  if (!f) return File();
+  fseek(f, 0, SEEK_END);
+  long size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  uint8_t *data = (uint8_t *)malloc(size ? size : 1);
+  if (fread(data, 1, size, f) != (size_t)size) {
+    free(data);
+    fclose(f);
+    return File();
+  }
+  fclose(f);
+  return File(data, size);
+}
+
+boolean SDClass::exists(const char *filepath) {
+  FILE *f = fopen(filepath, "rb");
+  if (f) fclose(f);
+  return f != NULL;
+}
+
+boolean SDClass::remove(const char *filepath) {
+  return ::remove(filepath) == 0;
+}
+
+uint8_t Sd2Card::init(uint8_t sckRateID, uint8_t chipSelectPin) {
+  return true;
+}
+
+uint8_t SdVolume::init(Sd2Card *dev) {
+  return true;
+}
+
+SdFile::SdFile() : root(false), f(NULL) {}
+
+uint8_t SdFile::openRoot(SdVolume *vol) {
+  root = true;
+  return true;
+}
+
+uint8_t SdFile::open(SdFile *dirFile, const char *fileName, uint8_t oflag) {
+  if (f || !dirFile->root) return false;
+  if ((oflag & O_EXCL) && SD.exists(fileName)) return false;
+  if (!(oflag & O_CREAT) && !SD.exists(fileName)) return false;
+  const char *how = "rb";
+  if (oflag & O_WRITE) {
+    how = oflag & O_TRUNC ? "wb" : oflag & O_APPEND ? "ab" : "r+b";
+  }
+  f = fopen(fileName, how);
+  return f != NULL;
+}
+
+uint8_t SdFile::isOpen() {
+  return f != NULL;
+}
+
+int16_t SdFile::read(void *buf, uint16_t nbyte) {
+  if (!f) return -1;
+  size_t n = fread(buf, 1, nbyte, f);
+  SD.reads++;
+  SD.bytesRead += n;
+  return n;
+}
+
+int16_t SdFile::write(const void *buf, uint16_t nbyte) {
+  if (!f) return -1;
+  SD.writes++;
+  SD.bytesWritten += nbyte;
+  return fwrite(buf, 1, nbyte, f);
+}
+
+uint8_t SdFile::close() {
+  if (!f) return false;
+  fclose(f);
+  f = NULL;
+  return true;
+}
+
+uint8_t SdFile::remove(SdFile *dirFile, const char *fileName) {
+  return ::remove(fileName) == 0;
+}
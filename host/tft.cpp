@@ -0,0 +1,118 @@
+/*
+ * Host implementations of the Adafruit GFX and ST7735 stand-ins.
+ */
+
+#include "Adafruit_ST7735.h"
+
+Adafruit_GFX::Adafruit_GFX(int16_t w, int16_t h)
+  : _width(w), _height(h), cursor_x(0), cursor_y(0),
+    textcolor(0xFFFF), textbgcolor(0xFFFF) {}
+
+void Adafruit_GFX::fillRect(int16_t x, int16_t y, int16_t w, int16_t h,
+    uint16_t color) {
+  for (int16_t j = y; j < y + h; j++) {
+    for (int16_t i = x; i < x + w; i++) {
+      drawPixel(i, j, color);
+    }
+  }
+}
+
+void Adafruit_GFX::fillScreen(uint16_t color) {
+  fillRect(0, 0, _width, _height, color);
+}
+
+void Adafruit_GFX::setCursor(int16_t x, int16_t y) {
+  cursor_x = x;
+  cursor_y = y;
+}
+
+void Adafruit_GFX::setTextColor(uint16_t c) {
+  textcolor = textbgcolor = c;
+}
+
+void Adafruit_GFX::setTextColor(uint16_t c, uint16_t bg) {
+  textcolor = c;
+  textbgcolor = bg;
+}
+
+// 6x8 character cells, wrapping at the right edge like the real library
+size_t Adafruit_GFX::print(const char *s) {
+  size_t n = 0;
+  for (; *s; s++, n++) {
+    if (*s == '\n') {
+      cursor_x = 0;
+      cursor_y += 8;
+    } else if (*s != '\r') {
+      cursor_x += 6;
+      if (cursor_x > _width - 6) {
+        cursor_x = 0;
+        cursor_y += 8;
+      }
+    }
+  }
+  return n;
+}
+
+size_t Adafruit_GFX::print(const __FlashStringHelper *s) {
+  return print(reinterpret_cast<const char *>(s));
+}
+
+size_t Adafruit_GFX::print(char c) {
+  char s[2] = {c, 0};
+  return print(s);
+}
+
+// what the driver sends for each operation: CASET and RASET are a command
+// byte plus four data bytes each, RAMWR a single command byte, and every
+// pixel two bytes of colour
+#define SPI_WINDOW_BYTES 11
+#define SPI_PIXEL_BYTES 2
+
+Adafruit_ST7735::Adafruit_ST7735(uint8_t cs, uint8_t rs, uint8_t rst)
+  : Adafruit_GFX(ST7735_TFTWIDTH, ST7735_TFTHEIGHT),
+    winX0(0), winY0(0), winX1(0), winY1(0), curX(0), curY(0), spiBytes(0) {
+  memset(fb, 0, sizeof(fb));
+}
+
+void Adafruit_ST7735::initR(uint8_t options) {}
+
+void Adafruit_ST7735::setAddrWindow(uint8_t x0, uint8_t y0, uint8_t x1,
+    uint8_t y1) {
+  winX0 = curX = x0;
+  winY0 = curY = y0;
+  winX1 = x1;
+  winY1 = y1;
+  spiBytes += SPI_WINDOW_BYTES;
+}
+
+// writes at the window cursor, which walks rows left to right and wraps
+// back to the top of the window after the last row
+void Adafruit_ST7735::pushColor(uint16_t color) {
+  spiBytes += SPI_PIXEL_BYTES;
+  if (curX < _width && curY < _height) fb[curY][curX] = color;
+  if (curX++ >= winX1) {
+    curX = winX0;
+    if (curY++ >= winY1) curY = winY0;
+  }
+}
+
+void Adafruit_ST7735::drawPixel(int16_t x, int16_t y, uint16_t color) {
+  if (x < 0 || x >= _width || y < 0 || y >= _height) return;
+  fb[y][x] = color;
+  spiBytes += SPI_WINDOW_BYTES + SPI_PIXEL_BYTES;
+}
+
+void Adafruit_ST7735::fillRect(int16_t x, int16_t y, int16_t w, int16_t h,
+    uint16_t color) {
+  spiBytes += SPI_WINDOW_BYTES;
+  for (int16_t j = max(y, 0); j < min(y + h, _height); j++) {
+    for (int16_t i = max(x, 0); i < min(x + w, _width); i++) {
+      fb[j][i] = color;
+      spiBytes += SPI_PIXEL_BYTES;
+    }
+  }
+}
+
+uint16_t Adafruit_ST7735::getPixel(int16_t x, int16_t y) {
+  return fb[y][x];
+}
@@ -0,0 +1,173 @@
+/*
+ * Joystick sampling off the ADC interrupt, see joystick.h.
+ */
+
+#include "joystick.h"
+
+static uint8_t vert_pin;
+static uint8_t hor_pin;
+static uint8_t sel_pin;
+static int16_t vert_base;
+static int16_t hor_base;
+static int16_t dead;
+
+// the two snapshot buffers; the latest is snap[seq & 1] and the next is
+// built in the other, then seq moves on to publish it
+static joystick_state_t snap[2];
+static volatile uint8_t seq;
+
+#define NO_DIR 0xFF
+
+// pushes, written at pushes[push_in] and read at pushes[push_out], both
+// counting up and wrapping
+static uint8_t pushes[JOYSTICK_PUSHES];
+static volatile uint8_t push_in;
+static volatile uint8_t push_out;
+static uint8_t stick_dir;  // the way the stick points, or NO_DIR centred
+static uint8_t lost;
+
+// debounced button
+static uint8_t button;
+static uint8_t presses;
+static uint32_t button_at;  // millis() of the last accepted change
+
+static int16_t filter(int16_t d) {
+  return abs(d) > dead ? d : 0;
+}
+
+// returns the way the stick points, the axis pushed further, or NO_DIR if
+// it is centred or exactly diagonal
+static uint8_t direction(int16_t dx, int16_t dy) {
+  if (abs(dx) > abs(dy)) return dx > 0 ? JOYSTICK_RIGHT : JOYSTICK_LEFT;
+  if (abs(dy) > abs(dx)) return dy > 0 ? JOYSTICK_DOWN : JOYSTICK_UP;
+  return NO_DIR;
+}
+
+// builds a snapshot from one reading of each axis and the button
+static void publish(int16_t v, int16_t h, bool pressed, uint32_t now) {
+  joystick_state_t *s = &snap[(seq + 1) & 1];
+  s->dx = filter(h - hor_base);
+  s->dy = filter(v - vert_base);
+  uint8_t dir = direction(s->dx, s->dy);
+  if (dir != stick_dir && dir != NO_DIR) {
+    if ((uint8_t)(push_in - push_out) < JOYSTICK_PUSHES) {
+      pushes[push_in % JOYSTICK_PUSHES] = dir;
+      push_in++;
+    } else {
+      lost++;
+    }
+  }
+  stick_dir = dir;
+  // the first edge counts straight away and the bounces after it are
+  // ignored, so a press costs no latency
+  if (pressed != button && now - button_at >= JOYSTICK_DEBOUNCE_MS) {
+    button = pressed;
+    button_at = now;
+    if (pressed) presses++;
+  }
+  s->button = button;
+  s->presses = presses;
+  s->lost = lost;
+  // snap is not volatile, so keep its stores ahead of the publish
+  asm volatile("" ::: "memory");
+  seq++;
+}
+
+#ifndef HOST
+
+static volatile uint8_t *sel_in;
+static uint8_t sel_mask;
+static bool on_hor;       // converting the horizontal half of a pair
+static int16_t vert_raw;  // the vertical half of the pair in progress
+
+// points the ADC at an analog pin, referenced to AVcc as analogRead() does
+static void adc_select(uint8_t pin) {
+  ADMUX = _BV(REFS0) | (pin & 7);
+#ifdef MUX5
+  ADCSRB = (ADCSRB & ~_BV(MUX5)) | ((pin >> 3) & 1) << MUX5;
+#endif
+}
+
+ISR(ADC_vect) {
+  int16_t v = ADC;
+  if (on_hor) {
+    publish(vert_raw, v, !(*sel_in & sel_mask), millis());
+    adc_select(vert_pin);
+  } else {
+    vert_raw = v;
+    adc_select(hor_pin);
+  }
+  on_hor = !on_hor;
+  ADCSRA |= _BV(ADSC);
+}
+
+void joystick_begin(uint8_t vert, uint8_t hor, uint8_t sel, uint16_t dead_zone)
+{
+  vert_pin = vert;
+  hor_pin = hor;
+  sel_pin = sel;
+  dead = dead_zone;
+  pinMode(sel_pin, INPUT_PULLUP);
+  sel_in = portInputRegister(digitalPinToPort(sel_pin));
+  sel_mask = digitalPinToBitMask(sel_pin);
+  vert_base = analogRead(vert_pin);
+  hor_base = analogRead(hor_pin);
+  stick_dir = NO_DIR;
+  button = !(*sel_in & sel_mask);
+  // the core's init() left the ADC enabled with its clock at 125 kHz
+  on_hor = false;
+  adc_select(vert_pin);
+  ADCSRA |= _BV(ADIE) | _BV(ADSC);
+}
+
+void joystick_read(joystick_state_t *out)
+{
+  // a publish in the middle of the copy moves seq on, and only a second
+  // one would touch the buffer being copied, so copy again until it holds.
+  // The barriers keep the compiler from moving the copy of the non-volatile
+  // snap out from between the two reads of seq.
+  uint8_t s;
+  do {
+    s = seq;
+    asm volatile("" ::: "memory");
+    *out = snap[s & 1];
+    asm volatile("" ::: "memory");
+  } while (s != seq);
+}
+
+#else
+
+void joystick_begin(uint8_t vert, uint8_t hor, uint8_t sel, uint16_t dead_zone)
+{
+  vert_pin = vert;
+  hor_pin = hor;
+  sel_pin = sel;
+  dead = dead_zone;
+  vert_base = analogRead(vert_pin);
+  hor_base = analogRead(hor_pin);
+  stick_dir = NO_DIR;
+  button = !digitalRead(sel_pin);
+}
+
+void joystick_read(joystick_state_t *out)
+{
+  publish(analogRead(vert_pin), analogRead(hor_pin), !digitalRead(sel_pin),
+          millis());
+  *out = snap[seq & 1];
+}
+
+#endif
+
+bool joystick_push(uint8_t *dir)
+{
+  // only the interrupt moves push_in and only this moves push_out
+  if (push_out == push_in) return false;
+  *dir = pushes[push_out % JOYSTICK_PUSHES];
+  push_out++;
+  return true;
+}
+
+void joystick_clear_pushes()
+{
+  push_out = push_in;
+}
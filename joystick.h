@@ -0,0 +1,67 @@
+/*
+ * Joystick sampling off the ADC interrupt.
+ *
+ * Once started the ADC converts the two stick axes back to back forever,
+ * each conversion complete interrupt starting the next, and the button is
+ * read alongside every horizontal conversion.  Each pair of conversions
+ * becomes a snapshot: the deflection of each axis from its resting value,
+ * zeroed inside the dead zone, and the debounced button.  The interrupt
+ * builds a snapshot in one of two buffers while the game reads the other,
+ * so joystick_read() is a short copy that never waits on a conversion.
+ *
+ * A flick of the stick can come and go between two reads, so every time
+ * the stick is pushed a new way the interrupt also appends the direction
+ * to a small ring, for joystick_push() to hand out in order.
+ *
+ * At the core's ADC clock of 125 kHz a conversion takes 104 us, so a
+ * fresh snapshot is ready about every 210 us.
+ *
+ * The host build has no ADC; joystick_read() samples the stand-in pins
+ * there instead, through the same filtering.
+ */
+
+#ifndef _JOYSTICK_H
+#define _JOYSTICK_H
+
+#include <Arduino.h>
+
+// a button change this soon after the last one is contact bounce
+#define JOYSTICK_DEBOUNCE_MS 5
+
+// pushes kept for joystick_push(), a power of 2
+#define JOYSTICK_PUSHES 4
+
+// push directions, in the same order as the game's
+#define JOYSTICK_UP    0
+#define JOYSTICK_RIGHT 1
+#define JOYSTICK_DOWN  2
+#define JOYSTICK_LEFT  3
+
+typedef struct {
+  int16_t dx;       // right of centre is positive, 0 inside the dead zone
+  int16_t dy;       // down from centre is positive, 0 inside the dead zone
+  uint8_t button;   // 1 while held down, debounced
+  uint8_t presses;  // debounced presses so far, wraps
+  uint8_t lost;     // pushes the ring had no room for, wraps
+} joystick_state_t;
+
+/* Reads the resting position of the axes on the analog pins vert and hor,
+ * sets up the button on sel and starts sampling.  Deflections of at most
+ * dead_zone either way read as 0.  The rest of the sketch must not call
+ * analogRead() after this.
+ */
+void joystick_begin(uint8_t vert, uint8_t hor, uint8_t sel, uint16_t dead_zone);
+
+/* Copies the latest snapshot to out. */
+void joystick_read(joystick_state_t *out);
+
+/* Takes the oldest push not yet taken: sets dir to the way the stick went,
+ * one of JOYSTICK_UP..JOYSTICK_LEFT, and returns true, or returns false if
+ * there is none.  On the host, pushes are only seen by joystick_read().
+ */
+bool joystick_push(uint8_t *dir);
+
+/* Forgets the pushes not yet taken. */
+void joystick_clear_pushes();
+
+#endif
@@ -9,6 +9,236 @@
 
 #include "lcd_image.h"
 
+bool lcd_image_read_header(lcd_image_t *img)
+{
+  File file;
+  lcd_image_header_t header;
+
+  if (!(file = SD.open(img->file_name))) {
+    return false;
+  }
+  int n = file.read((uint8_t *) &header, sizeof(header));
+  file.close();
+
+  if (n != sizeof(header) ||
+      memcmp(header.magic, LCD_IMAGE_MAGIC, sizeof(header.magic)) != 0 ||
+      header.version != LCD_IMAGE_VERSION) {
+    return false;
+  }
+  img->ncols = header.ncols;
+  img->nrows = header.nrows;
+  img->format = header.format;
+  img->data_offset = LCD_IMAGE_HEADER_SIZE;
+  return true;
+}
+
+/* Draws an uncompressed patch, the window is already set up.
+ */
+static void draw_raw(lcd_image_t *img, Adafruit_ST7735 *tft, File *file,
+                     uint16_t icol, uint16_t irow,
+                     uint16_t width, uint16_t height)
+{
+  // A full width patch is one contiguous stretch of the file, so it is read
+  // as a single run.  Otherwise each row is a run of its own.
+  uint32_t run_len = width;
+  uint16_t runs = height;
+  if (width == img->ncols) {
+    run_len = (uint32_t) width * height;
+    runs = 1;
+  }
+
+  uint16_t pixels[LCD_IMAGE_BUF_PIXELS];
+
+  for (uint16_t run=0; run < runs; run++) {
+    // Start of pixels to read from, need 32 bit arith for big images
+    uint32_t pos = ( (uint32_t) irow +  (uint32_t) run) *
+      (2 *  (uint32_t) img->ncols) +  (uint32_t) icol * 2 + img->data_offset;
+
+    // only seek when not already there
+    if (file->position() != pos) {
+      file->seek(pos);
+    }
+
+    for (uint32_t left = run_len; left > 0; ) {
+      uint16_t n = left < LCD_IMAGE_BUF_PIXELS ? left : LCD_IMAGE_BUF_PIXELS;
+
+      // Read a chunk of pixels
+      if (file->read((uint8_t *) pixels, 2 * n) != 2 * n) {
+        Serial.println("SD Card Read Error!");
+        return;
+      }
+
+      // Send pixels to display
+      if (img->format == LCD_IMAGE_NATIVE) {
+        for (uint16_t i=0; i < n; i++) {
+          tft->pushColor(pixels[i]);
+        }
+      }
+      else {
+        for (uint16_t i=0; i < n; i++) {
+          uint16_t pixel = pixels[i];
+
+          // pixel bytes in reverse order on card
+          pixel = (pixel << 8) | (pixel >> 8);
+          tft->pushColor(pixel);
+        }
+      }
+      left -= n;
+    }
+  }
+}
+
+/* Buffered reader for the run length decoder, so control bytes and short
+ * runs do not each cost a card read.  Seeks are put off until the next
+ * refill, so skipping pixels or moving to another row costs nothing until
+ * more of the file is needed.
+ */
+typedef struct {
+  File *file;
+  uint8_t buf[2 * LCD_IMAGE_BUF_PIXELS];
+  uint16_t len;
+  uint16_t at;
+  uint32_t next;  // file offset of the byte after buf[len - 1]
+  bool error;
+} rle_reader_t;
+
+static uint8_t rle_byte(rle_reader_t *r)
+{
+  if (r->at == r->len) {
+    if (r->file->position() != r->next) {
+      r->file->seek(r->next);
+    }
+    int n = r->file->read(r->buf, sizeof(r->buf));
+    r->at = 0;
+    r->len = n > 0 ? n : 0;
+    r->next += r->len;
+    if (r->len == 0) {
+      r->error = true;
+      return 0;
+    }
+  }
+  return r->buf[r->at++];
+}
+
+static uint16_t rle_pixel(rle_reader_t *r)
+{
+  uint16_t lo = rle_byte(r);
+  return lo | (rle_byte(r) << 8);
+}
+
+// skips n literal pixels, past the buffer if need be without reading them
+static void rle_skip(rle_reader_t *r, uint16_t n)
+{
+  uint16_t bytes = 2 * n;
+  if (bytes <= r->len - r->at) {
+    r->at += bytes;
+    return;
+  }
+  r->next += bytes - (r->len - r->at);
+  r->at = r->len = 0;
+}
+
+// moves the reader to file offset pos, keeping the buffer if it holds it
+static void rle_seek(rle_reader_t *r, uint32_t pos)
+{
+  uint32_t first = r->next - r->len;
+  if (pos >= first && pos < r->next) {
+    r->at = pos - first;
+  }
+  else {
+    r->at = r->len = 0;
+    r->next = pos;
+  }
+}
+
+/* Row index entries draw_rle reads from the card at a time. */
+#define RLE_INDEX_ROWS 16
+
+/* Draws a patch of an LCD_IMAGE_RLE image, the window is already set up.
+ *
+ * Decoding a row stops at the right edge of the patch.  The runs left in
+ * the row are skipped while their control bytes are already buffered, so
+ * short rows still follow on from each other, but once the buffer runs out
+ * the next row is found in the row index and the rest of this one is never
+ * read.
+ */
+static void draw_rle(lcd_image_t *img, Adafruit_ST7735 *tft, File *file,
+                     uint16_t icol, uint16_t irow,
+                     uint16_t width, uint16_t height)
+{
+  rle_reader_t r;
+  r.file = file;
+  r.len = r.at = 0;
+  r.next = 0;
+  r.error = false;
+
+  uint8_t index[4 * RLE_INDEX_ROWS];
+  int32_t index_row = -1;  // first row in index, none yet
+  bool found = false;      // reader is at the start of the next row
+  uint16_t ecol = icol + width;
+
+  for (uint16_t row = 0; row < height && !r.error; row++) {
+    if (!found) {
+      uint16_t k = row - index_row;
+      if (index_row < 0 || k >= RLE_INDEX_ROWS) {
+        uint16_t rows = height - row < RLE_INDEX_ROWS ?
+          height - row : RLE_INDEX_ROWS;
+        file->seek(img->data_offset + 4 * ((uint32_t) irow + row));
+        if (file->read(index, 4 * rows) != 4 * rows) {
+          r.error = true;
+          break;
+        }
+        index_row = row;
+        k = 0;
+      }
+      uint8_t *p = &index[4 * k];
+      rle_seek(&r, p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) |
+               ((uint32_t) p[3] << 24));
+    }
+
+    uint16_t col = 0;
+    while (col < ecol && !r.error) {
+      uint8_t c = rle_byte(&r);
+      uint16_t count = (c & ~LCD_IMAGE_RLE_REPEAT) + 1;
+      uint16_t end = col + count;
+
+      // part of this run inside the patch, empty when lo >= hi
+      uint16_t lo = col > icol ? col : icol;
+      uint16_t hi = end < ecol ? end : ecol;
+
+      if (c & LCD_IMAGE_RLE_REPEAT) {
+        uint16_t pixel = rle_pixel(&r);
+        for (uint16_t i = lo; i < hi; i++) {
+          tft->pushColor(pixel);
+        }
+      }
+      else if (lo < hi) {
+        rle_skip(&r, lo - col);
+        for (uint16_t i = lo; i < hi; i++) {
+          tft->pushColor(rle_pixel(&r));
+        }
+        rle_skip(&r, end - hi);
+      }
+      else {
+        rle_skip(&r, count);
+      }
+      col = end;
+    }
+
+    // the rest of the row, as far as the buffer goes
+    while (col < img->ncols && r.at < r.len) {
+      uint8_t c = r.buf[r.at++];
+      col += (c & ~LCD_IMAGE_RLE_REPEAT) + 1;
+      rle_skip(&r, c & LCD_IMAGE_RLE_REPEAT ? 1 : (c & 0x7F) + 1);
+    }
+    found = col == img->ncols;
+  }
+
+  if (r.error) {
+    Serial.println("SD Card Read Error!");
+  }
+}
+
 /* Draws the referenced image to the LCD screen.
  *
  * img           : the image to draw
@@ -25,7 +255,7 @@ void lcd_image_draw(lcd_image_t *img, Adafruit_ST7735 *tft,
   File file;
 
   // Open requested file on SD card if not already open
-  if ((file = SD.open(img->file_name)) == NULL) {
+  if (!(file = SD.open(img->file_name))) {
     Serial.print("File not found:'");
     Serial.print(img->file_name);
     Serial.println('\'');
@@ -35,31 +265,12 @@ void lcd_image_draw(lcd_image_t *img, Adafruit_ST7735 *tft,
   // Setup display to receive window of pixels
   tft->setAddrWindow(scol, srow, scol+width-1, srow+height-1);
 
-  for (uint16_t row=0; row < height; row++) {
-    uint16_t pixels[width];
-
-    // Seek to start of pixels to read from, need 32 bit arith for big images
-    uint32_t pos = ( (uint32_t) irow +  (uint32_t) row) *
-      (2 *  (uint32_t) img->ncols) +  (uint32_t) icol * 2;
-    file.seek(pos);
-
-    // Read row of pixels
-    if (file.read((uint8_t *) pixels, 2 * width) != 2 * width) {
-      Serial.println("SD Card Read Error!");
-      file.close();
-      return;
-    }
-    
-    // Send pixels to display
-    for (uint16_t col=0; col < width; col++) {
-      uint16_t pixel = pixels[col];
-      
-      // pixel bytes in reverse order on card
-      pixel = (pixel << 8) | (pixel >> 8);
-      tft->pushColor(pixel);
-    }
+  if (img->format == LCD_IMAGE_RLE) {
+    draw_rle(img, tft, &file, icol, irow, width, height);
+  }
+  else {
+    draw_raw(img, tft, &file, icol, irow, width, height);
   }
 
   file.close();
 }
-
@@ -5,12 +5,73 @@
 #ifndef _LCD_IMAGE_H
 #define _LCD_IMAGE_H
 
+/* Pixels read from the card per file.read() call.  The buffer lives on the
+ * stack while drawing, 2 bytes per pixel.
+ */
+#define LCD_IMAGE_BUF_PIXELS 128
+
+/* Pixel formats.
+ *
+ * LCD_IMAGE_SWAPPED : RGB565 with the high byte first, the original format
+ *                     of the headerless images.  Each pixel has to be byte
+ *                     swapped before it is handed to pushColor.
+ * LCD_IMAGE_NATIVE  : RGB565 in the arduino's own (little endian) byte
+ *                     order, ready to hand to pushColor as it is read.
+ * LCD_IMAGE_RLE     : run length encoded native pixels, see below.  Only
+ *                     possible with a header.
+ */
+#define LCD_IMAGE_SWAPPED 0
+#define LCD_IMAGE_NATIVE  1
+#define LCD_IMAGE_RLE     2
+
+/* An LCD_IMAGE_RLE file has a row index after the header, one 32 bit file
+ * offset per row giving where that row's runs start, then the rows.  Each
+ * row is encoded on its own as a sequence of runs, each a control byte c
+ * followed by native pixels:
+ *
+ *   c & LCD_IMAGE_RLE_REPEAT : one pixel, repeated (c & 0x7F) + 1 times
+ *   otherwise                : c + 1 literal pixels
+ *
+ * so a run covers 1 to LCD_IMAGE_RLE_MAX_RUN pixels and never crosses the
+ * end of a row.
+ */
+#define LCD_IMAGE_RLE_REPEAT 0x80
+#define LCD_IMAGE_RLE_MAX_RUN 128
+
+/* Optional header at the start of an image file.  Multi-byte fields are
+ * little endian.  Files without one are LCD_IMAGE_SWAPPED pixels from the
+ * first byte, and their size has to be given in lcd_image_t.
+ */
+#define LCD_IMAGE_MAGIC "LCDI"
+#define LCD_IMAGE_VERSION 1
+#define LCD_IMAGE_HEADER_SIZE 16
+
+typedef struct {
+  char magic[4];        // LCD_IMAGE_MAGIC, not NUL terminated
+  uint8_t version;      // LCD_IMAGE_VERSION
+  uint8_t format;       // one of the pixel formats above
+  uint16_t ncols;
+  uint16_t nrows;
+  uint8_t reserved[6];  // zero, pads the header to LCD_IMAGE_HEADER_SIZE
+} lcd_image_header_t;
+
 typedef struct {
   char *file_name;
   uint16_t ncols;
   uint16_t nrows;
+  uint8_t format;        // LCD_IMAGE_SWAPPED unless set from a header
+  uint16_t data_offset;  // bytes in the file before the first pixel, or
+                         // before the row index of an LCD_IMAGE_RLE file
 } lcd_image_t;
 
+/* Reads the header of img->file_name, if it has one, into img.
+ *
+ * Returns true and sets the size, format and data offset from the header,
+ * or returns false and leaves img alone for a headerless file or one that
+ * cannot be read.
+ */
+bool lcd_image_read_header(lcd_image_t *img);
+
 /* Draws the referenced image to the LCD screen.
  *
  * img           : the image to draw
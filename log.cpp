@@ -0,0 +1,80 @@
+/*
+ * Binary event log, see log.h.
+ */
+
+#include "log.h"
+
+#if LOG_LEVEL > LOG_OFF
+
+static log_record_t ring[LOG_RECORDS];
+static uint8_t first;  // the oldest record
+static uint8_t count;
+static uint16_t dropped;  // records lost since the last DROPPED record
+
+static void push(uint8_t id, uint32_t a, uint16_t b, uint32_t c) {
+  log_record_t *r = &ring[(first + count) % LOG_RECORDS];
+  r->ms = millis();
+  r->id = id;
+  r->a = a;
+  r->b = b;
+  r->c = c;
+  count++;
+}
+
+static uint8_t *put32(uint8_t *p, uint32_t v) {
+  for (uint8_t i = 0; i < 4; i++) {
+    *p++ = v >> (8 * i);
+  }
+  return p;
+}
+
+// sends the oldest record as one write, so it never straddles another's
+static void send(HardwareSerial &port) {
+  const log_record_t *r = &ring[first];
+  uint8_t frame[LOG_FRAME_SIZE];
+  uint8_t *p = frame;
+  *p++ = LOG_MAGIC;
+  *p++ = r->id;
+  p = put32(p, r->ms);
+  p = put32(p, r->a);
+  *p++ = r->b;
+  *p++ = r->b >> 8;
+  put32(p, r->c);
+  port.write(frame, sizeof(frame));
+  first = (first + 1) % LOG_RECORDS;
+  count--;
+}
+
+void log_put(uint8_t id, uint32_t a, uint16_t b, uint32_t c) {
+  // the count of lost records goes in ahead of the next one that fits
+  if (dropped) {
+    if (count + 2 > LOG_RECORDS) {
+      if (dropped < 0xFFFF) dropped++;
+      return;
+    }
+    push(LOG_DROPPED, dropped, 0, 0);
+    dropped = 0;
+  }
+  if (count == LOG_RECORDS) {
+    dropped = 1;
+    return;
+  }
+  push(id, a, b, c);
+}
+
+void log_drain(HardwareSerial &port) {
+  while (count && port.availableForWrite() >= LOG_FRAME_SIZE) {
+    send(port);
+  }
+}
+
+void log_flush(HardwareSerial &port) {
+  if (dropped) {
+    while (count > LOG_RECORDS - 1) send(port);
+    push(LOG_DROPPED, dropped, 0, 0);
+    dropped = 0;
+  }
+  while (count) send(port);
+}
+
+#endif
@@ -0,0 +1,111 @@
+/*
+ * Binary event log, drained to the console when the game has time.
+ *
+ * LOG(name, a, b, c) appends a fixed size record to a ring in RAM: the
+ * message's number, millis() and up to three numbers for it.  Nothing is
+ * formatted or sent on the board, so a log call costs a tick a few dozen
+ * cycles even on a 9600 baud console whose transmit buffer is full.
+ * log_drain() sends records only while the console's transmit buffer has
+ * room for a whole one, so it never blocks, and the game calls it where it
+ * would otherwise idle.  When the ring is full new records are dropped and
+ * counted, and the count goes out as a record of its own.
+ *
+ * Each message has a level, and LOG_LEVEL picks at compile time the most
+ * detailed one kept: the LOG() calls of any message above it compile to
+ * nothing, and with LOG_LEVEL at LOG_OFF the ring and the drain go too.
+ *
+ * On the wire each record is LOG_MAGIC and its fields, little endian, amid
+ * the console's plain text.  The text of every message lives only in the
+ * table below, which the board never expands; tools/log_decode turns a
+ * console capture back into text with it.
+ */
+
+#ifndef _LOG_H
+#define _LOG_H
+
+#include <Arduino.h>
+
+#define LOG_OFF   0
+#define LOG_ERROR 1
+#define LOG_WARN  2
+#define LOG_INFO  3
+#define LOG_DEBUG 4
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_INFO
+#endif
+
+// records waiting to be drained, 15 bytes each; the game drains the ring
+// whenever it idles, so it only has to cover a burst such as a link's
+// connect and rate steps
+#define LOG_RECORDS 8
+
+// every message as X(name, level, printf format); the format takes a, b
+// and c in that order, each as an unsigned long, and any it leaves out must
+// come last.  New messages go at the end, so old captures still decode.
+#define LOG_MESSAGES(X) \
+  X(DROPPED, LOG_WARN, "%lu log records dropped") \
+  X(HELLO, LOG_INFO, "I am here") \
+  X(CONNECTED, LOG_INFO, "Connected in %lu ms after %lu attempts, session %lx") \
+  X(BAUD, LOG_DEBUG, "Now at %lu baud to snake %lu") \
+  X(BAUD_FAILED, LOG_WARN, "%lu baud failed to snake %lu, back a step") \
+  X(BAUD_ERRORS, LOG_WARN, "CRC errors at %lu baud to snake %lu, dropping a step") \
+  X(MAIN_LOOP, LOG_INFO, "Beginning main snake loop") \
+  X(INPUT_SEQUENCE, LOG_WARN, "Lockstep input for tick %lu out of sequence from player %lu") \
+  X(RELAY_SEQUENCE, LOG_WARN, "Lockstep inputs for tick %lu out of sequence") \
+  X(RESYNC, LOG_WARN, "Game state differs from the server's at tick %lu, resyncing") \
+  X(REPLAYING, LOG_INFO, "Replaying") \
+  X(REPLAY_SNAKES, LOG_ERROR, "Replay is for a different number of snakes") \
+  X(NO_RECORD, LOG_ERROR, "Cannot record the replay") \
+  X(NO_REPLAY, LOG_ERROR, "Cannot play the replay")
+
+#define LOG_ID_(name, level, format) LOG_##name,
+enum { LOG_MESSAGES(LOG_ID_) LOG_IDS };
+#define LOG_LEVEL_(name, level, format) LOG_LEVEL_##name = level,
+enum { LOG_MESSAGES(LOG_LEVEL_) };
+
+// starts each record on the wire; the console's text is all ASCII
+#define LOG_MAGIC 0xFE
+// LOG_MAGIC, id, ms, a, b, c
+#define LOG_FRAME_SIZE 16
+
+typedef struct {
+  uint32_t ms;  // millis() when logged
+  uint32_t a;
+  uint32_t c;
+  uint16_t b;
+  uint8_t id;
+} log_record_t;
+
+#if LOG_LEVEL > LOG_OFF
+
+/* Appends a record of message id, or counts it as dropped if the ring is
+ * full.  Call LOG() instead, which leaves out the messages LOG_LEVEL does
+ * not keep.  Not for interrupt handlers.
+ */
+void log_put(uint8_t id, uint32_t a, uint16_t b, uint32_t c);
+
+/* Sends the oldest records to port for as long as its transmit buffer has
+ * room for a whole one, without waiting.
+ */
+void log_drain(HardwareSerial &port);
+
+/* Sends every record to port, waiting on the transmit buffer as needed,
+ * so text printed after it comes after them.
+ */
+void log_flush(HardwareSerial &port);
+
+#define LOG(name, a, b, c) \
+  do { \
+    if (LOG_LEVEL_##name <= LOG_LEVEL) log_put(LOG_##name, a, b, c); \
+  } while (0)
+
+#else
+
+#define LOG(name, a, b, c) do {} while (0)
+#define log_drain(port)
+#define log_flush(port)
+
+#endif
+
+#endif
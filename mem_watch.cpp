@@ -0,0 +1,107 @@
+/*
+ * Stack and heap watermarks, see mem_watch.h.
+ */
+
+#include "mem_watch.h"
+
+#ifndef HOST
+
+#include "mem_syms.h"
+
+// mem_syms.h's heap macros read the allocator's own variables, and using
+// those links the allocator in, which heap-check forbids.  Weak references
+// do not pull it from the library: without it they are null and the heap,
+// which then cannot grow, is empty at the linker's __heap_start.
+#pragma weak __brkval
+#pragma weak __malloc_heap_start
+extern char __heap_start;
+
+static char *heap_start() {
+  return &__malloc_heap_start ? __malloc_heap_start : &__heap_start;
+}
+
+static char *heap_end() {
+  return &__brkval && __brkval ? __brkval : heap_start();
+}
+
+// [heap_end(), stack_floor) is all paint: the stack has not been below
+// stack_floor since the last paint
+static char *stack_floor;
+
+static uint16_t stack_peak;
+static uint16_t heap_peak;
+static int16_t min_free = 0x7FFF;
+
+static void note_heap() {
+  uint16_t size = heap_end() - heap_start();
+  if (size > heap_peak) heap_peak = size;
+}
+
+static void note_stack(char *deepest) {
+  uint16_t depth = STACK_BOTTOM - deepest;
+  if (depth > stack_peak) stack_peak = depth;
+  int16_t avail = deepest - heap_end();
+  if (avail < min_free) min_free = avail;
+}
+
+// the deepest byte the stack has written since the last paint
+static char *find_deepest() {
+  char *heap = heap_end();
+  char *top = STACK_TOP - MEM_GUARD;
+  if (stack_floor < heap) stack_floor = heap;
+
+  // a new low: move the floor down past the new stack bytes
+  for (char *q = stack_floor; q > heap && q > stack_floor - MEM_GAP; ) {
+    q--;
+    if (*q != MEM_PAINT) stack_floor = q;
+  }
+
+  char *p = stack_floor;
+  while (p < top && *p == MEM_PAINT) p++;
+  return p;
+}
+
+void mem_paint() {
+  note_heap();
+  if (stack_floor) note_stack(find_deepest());
+  char *p = heap_end();
+  char *top = STACK_TOP - MEM_GUARD;
+  stack_floor = top;
+  while (p < top) *p++ = MEM_PAINT;
+}
+
+int16_t mem_check() {
+  note_heap();
+  char *deepest = find_deepest();
+  note_stack(deepest);
+  int16_t avail = deepest - heap_end();
+
+  char *top = STACK_TOP - MEM_GUARD;
+  for (char *p = deepest; p < top; p++) *p = MEM_PAINT;
+  return avail;
+}
+
+uint16_t mem_stack_peak() {
+  note_stack(find_deepest());
+  return stack_peak;
+}
+
+uint16_t mem_heap_peak() {
+  note_heap();
+  return heap_peak;
+}
+
+void mem_report(HardwareSerial &port) {
+  port.print(F("RAM: static "));
+  port.print((unsigned int) (heap_start() - (char *) RAMSTART));
+  port.print(F(" heap peak "));
+  port.print(mem_heap_peak());
+  port.print(F(" stack peak "));
+  port.print(mem_stack_peak());
+  port.print(F(" min free "));
+  port.print(min_free);
+  port.print(F(" of "));
+  port.println((unsigned int) (RAMEND + 1 - RAMSTART));
+}
+
+#endif
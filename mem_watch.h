@@ -0,0 +1,62 @@
+/*
+ * Stack and heap watermarks on top of mem_syms.h.
+ *
+ * mem_paint() fills the free RAM between the end of the heap and the stack
+ * with MEM_PAINT.  Bytes the stack later writes lose the paint, so scanning
+ * up from the heap for the first unpainted byte finds the deepest the stack
+ * has been since.  The heap's high water is sampled at the same time.
+ *
+ * Everything here is AVR only; the host build has no such memory map and
+ * the calls compile to nothing.
+ */
+
+#ifndef _MEM_WATCH_H
+#define _MEM_WATCH_H
+
+#include <Arduino.h>
+
+// value painted over free RAM
+#define MEM_PAINT 0xC5
+
+// bytes below the stack pointer left unpainted, room for an interrupt to
+// push its registers while painting
+#define MEM_GUARD 64
+
+// runs of untouched bytes up to this long inside a stack frame (unwritten
+// locals) are skipped over when looking for a new deepest point
+#define MEM_GAP 16
+
+#ifndef HOST
+
+/* Paints the free RAM and starts the watermarks over.  The stack peak up to
+ * now is kept.  Call first thing in main(), and again to measure a later
+ * part of the program on its own.
+ */
+void mem_paint();
+
+/* Returns the free RAM, between the heap end and the deepest byte the stack
+ * reached, since the previous call or mem_paint(), then repaints what the
+ * stack used so the next call measures only the code that runs after it.
+ * Costs time in proportion to the stack in use.
+ */
+int16_t mem_check();
+
+/* Deepest the stack has been since boot, in bytes below RAMEND. */
+uint16_t mem_stack_peak();
+
+/* Largest the heap has been, in bytes. */
+uint16_t mem_heap_peak();
+
+/* Prints static RAM use (.data and .bss), the stack and heap peaks and the
+ * least free RAM seen between them.
+ */
+void mem_report(HardwareSerial &port);
+
+#else
+
+#define mem_paint()
+#define mem_report(port)
+
+#endif
+
+#endif
@@ -0,0 +1,94 @@
+/*
+ * Framed binary packets for the links between the server and its clients.
+ */
+
+#include <Arduino.h>
+
+#include "packet.h"
+
+uint8_t crc8(const uint8_t *data, uint8_t len)
+{
+  uint8_t crc = 0;
+  while (len--) {
+    crc ^= *data++;
+    for (uint8_t bit = 0; bit < 8; bit++) {
+      crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1;
+    }
+  }
+  return crc;
+}
+
+uint8_t packet_build(uint8_t *out, uint8_t kind,
+                     const uint8_t *payload, uint8_t len)
+{
+  out[0] = PACKET_SYNC;
+  out[1] = (kind << 5) | (len & 0x1F);
+  memcpy(out + 2, payload, len);
+  out[len + 2] = crc8(out + 1, len + 1);
+  return len + PACKET_OVERHEAD;
+}
+
+void packet_send(HardwareSerial &port, uint8_t kind,
+                 const uint8_t *payload, uint8_t len)
+{
+  uint8_t out[PACKET_MAX_PAYLOAD + PACKET_OVERHEAD];
+
+  port.write(out, packet_build(out, kind, payload, len));
+}
+
+void packet_parser_init(packet_parser_t *p)
+{
+  p->n = 0;
+  p->dropped = 0;
+  p->crc_errors = 0;
+}
+
+void packet_feed(packet_parser_t *p, uint8_t b)
+{
+  // nothing before a SYNC is worth keeping
+  if (p->n == 0 && b != PACKET_SYNC) {
+    p->dropped++;
+    return;
+  }
+  // cannot happen while packet_next is called after every byte, but never
+  // write past the buffer
+  if (p->n == sizeof(p->buf)) {
+    p->dropped++;
+    return;
+  }
+  p->buf[p->n++] = b;
+}
+
+// drop the first k bytes in the parser, then skip ahead to the next SYNC
+static void packet_discard(packet_parser_t *p, uint8_t k)
+{
+  while (k < p->n && p->buf[k] != PACKET_SYNC) {
+    k++;
+    p->dropped++;
+  }
+  p->n -= k;
+  memmove(p->buf, p->buf + k, p->n);
+}
+
+bool packet_next(packet_parser_t *p, packet_t *pkt)
+{
+  while (p->n >= 2) {
+    uint8_t len = p->buf[1] & 0x1F;
+
+    if (p->n < len + PACKET_OVERHEAD) {
+      return false;
+    }
+    if (crc8(p->buf + 1, len + 1) != p->buf[len + 2]) {
+      // not a packet after all, try the next SYNC inside it
+      p->crc_errors++;
+      packet_discard(p, 1);
+      continue;
+    }
+    pkt->kind = p->buf[1] >> 5;
+    pkt->len = len;
+    memcpy(pkt->data, p->buf + 2, len);
+    packet_discard(p, len + PACKET_OVERHEAD);
+    return true;
+  }
+  return false;
+}
@@ -0,0 +1,77 @@
+/*
+ * Framed binary packets for the links between the server and its clients.
+ *
+ * A packet on the wire is
+ *
+ *   SYNC  HDR  payload...  CRC
+ *
+ * where HDR holds the packet kind in its top 3 bits and the payload length
+ * (0-31) in its low 5 bits, and CRC is a CRC-8 (polynomial 0x07) over HDR
+ * and the payload.  The receiver hunts for SYNC, and a packet that fails
+ * its CRC only costs the SYNC byte it started on, so the stream
+ * resynchronizes on the next good packet after corruption or a lost byte.
+ */
+
+#ifndef _PACKET_H
+#define _PACKET_H
+
+#include <Arduino.h>
+
+#define PACKET_SYNC 0xA5
+#define PACKET_MAX_PAYLOAD 31
+
+// header, sync and crc bytes around the payload
+#define PACKET_OVERHEAD 3
+
+// packet kinds
+#define PACKET_TICK    0  // tick number followed by event bytes
+#define PACKET_HELLO   1  // client nonce, asks the server for a session
+#define PACKET_WELCOME 2  // client nonce, server nonce, client's snake
+#define PACKET_READY   3  // client nonce, server nonce; session is up
+#define PACKET_HASH    4  // tick, hash of the server's game state before it
+#define PACKET_RESYNC  5  // tick of a hash the client's state did not match
+#define PACKET_STATE   6  // tick, snake, offset, part of a snake's state;
+                          // from a client, the tick of the one it took
+#define PACKET_BAUD    7  // op, link rate step, op's fields; see snake.cpp
+
+typedef struct {
+  uint8_t kind;
+  uint8_t len;
+  uint8_t data[PACKET_MAX_PAYLOAD];
+} packet_t;
+
+typedef struct {
+  uint8_t buf[PACKET_MAX_PAYLOAD + PACKET_OVERHEAD];
+  uint8_t n;            // bytes held in buf
+  uint16_t dropped;     // bytes skipped while hunting for SYNC
+  uint16_t crc_errors;  // candidate packets rejected by their CRC
+} packet_parser_t;
+
+/* CRC-8, polynomial 0x07, initial value 0 */
+uint8_t crc8(const uint8_t *data, uint8_t len);
+
+/* Frames a payload into out, which must hold len + PACKET_OVERHEAD bytes.
+ * Returns the number of bytes written.
+ */
+uint8_t packet_build(uint8_t *out, uint8_t kind,
+                     const uint8_t *payload, uint8_t len);
+
+/* Frames a payload and sends it with a single write. */
+void packet_send(HardwareSerial &port, uint8_t kind,
+                 const uint8_t *payload, uint8_t len);
+
+/* Resets a parser to its empty state and clears its counters. */
+void packet_parser_init(packet_parser_t *p);
+
+/* Adds one received byte to the parser. */
+void packet_feed(packet_parser_t *p, uint8_t b);
+
+/* Takes the next complete, valid packet out of the parser.
+ *
+ * Returns true and fills pkt if there was one, false if more bytes are
+ * needed.  Garbage and corrupt packets ahead of it are discarded and
+ * counted.
+ */
+bool packet_next(packet_parser_t *p, packet_t *pkt);
+
+#endif
@@ -0,0 +1,180 @@
+/*
+ * Per-phase frame profiler, see profile.h.
+ */
+
+#include "profile.h"
+#include "mem_watch.h"
+
+#ifdef PROFILE
+
+#ifdef HOST
+#include <stdio.h>
+#endif
+
+static const char *phase_names[PROFILE_PHASES] = {
+  "serial", "joystick", "update", "collide", "draw", "tick"
+};
+
+static profile_frame_t ring[PROFILE_FRAMES];
+static uint32_t frames;  // frames closed so far, the ring has the last ones
+
+static profile_frame_t current;
+static bool frame_open;
+
+static uint16_t hist[PROFILE_PHASES][PROFILE_BUCKETS];
+static uint32_t total[PROFILE_PHASES];
+static uint16_t longest[PROFILE_PHASES];
+
+#ifndef HOST
+// least free RAM seen at the end of each phase, see mem_check()
+static int16_t min_free[PROFILE_PHASES];
+// us spent in those checks, which profile_micros() leaves out
+static uint32_t checking;
+#endif
+
+uint32_t profile_micros() {
+#ifndef HOST
+  return micros() - checking;
+#else
+  return micros();
+#endif
+}
+
+static uint8_t bucket(uint16_t us) {
+  uint8_t b = 0;
+  while (us) {
+    us >>= 1;
+    b++;
+  }
+  return b < PROFILE_BUCKETS ? b : PROFILE_BUCKETS - 1;
+}
+
+static void close_frame() {
+  if (!frame_open) return;
+  frame_open = false;
+  ring[frames % PROFILE_FRAMES] = current;
+  frames++;
+  for (uint8_t p = 0; p < PROFILE_PHASES; p++) {
+    uint16_t us = current.us[p];
+    uint16_t *count = &hist[p][bucket(us)];
+    if (*count < 0xFFFF) (*count)++;
+    total[p] += us;
+    if (us > longest[p]) longest[p] = us;
+  }
+}
+
+void profile_frame() {
+#ifndef HOST
+  if (!frames && !frame_open) {
+    for (uint8_t p = 0; p < PROFILE_PHASES; p++) min_free[p] = 0x7FFF;
+  }
+#endif
+  close_frame();
+  current.start = profile_micros();
+  for (uint8_t p = 0; p < PROFILE_PHASES; p++) {
+    current.offset[p] = PROFILE_NOT_RUN;
+    current.us[p] = 0;
+  }
+  frame_open = true;
+}
+
+void profile_add(uint8_t phase, uint32_t start, uint32_t us) {
+  if (!frame_open) return;
+  if (current.offset[phase] == PROFILE_NOT_RUN) {
+    uint32_t offset = start - current.start;
+    current.offset[phase] = offset < PROFILE_NOT_RUN ? offset : PROFILE_NOT_RUN - 1;
+  }
+  uint32_t sum = current.us[phase] + us;
+  current.us[phase] = sum < 0xFFFF ? sum : 0xFFFF;
+
+#ifndef HOST
+  // the tick is made of the other phases, whose checks have already
+  // repainted the stack it used.  A check walks the whole stack, so its
+  // time is taken off the clock of the tick around it.
+  if (phase != PROFILE_TICK) {
+    uint32_t check_start = micros();
+    int16_t avail = mem_check();
+    if (avail < min_free[phase]) min_free[phase] = avail;
+    checking += micros() - check_start;
+  }
+#endif
+}
+
+void profile_dump(HardwareSerial &port) {
+  close_frame();
+  port.print(F("profile: "));
+  port.print(frames);
+  port.println(F(" frames, us per frame"));
+  if (!frames) return;
+  for (uint8_t p = 0; p < PROFILE_PHASES; p++) {
+    port.print(phase_names[p]);
+    port.print(F(": avg "));
+    port.print(total[p] / frames);
+    port.print(F(" max "));
+    port.print((unsigned int) longest[p]);
+#ifndef HOST
+    if (p != PROFILE_TICK) {
+      port.print(F(" min free RAM "));
+      port.print(min_free[p]);
+    }
+#endif
+    port.print(F(" |"));
+    // each bucket as "<upper bound>:frames"
+    for (uint8_t b = 0; b < PROFILE_BUCKETS; b++) {
+      if (!hist[p][b]) continue;
+      port.print(' ');
+      if (b == PROFILE_BUCKETS - 1) {
+        port.print('>');
+        port.print(1UL << (b - 1));
+      }
+      else {
+        port.print('<');
+        port.print(1UL << b);
+      }
+      port.print(':');
+      port.print((unsigned int) hist[p][b]);
+    }
+    port.println();
+  }
+}
+
+#ifdef HOST
+void profile_write_trace() {
+  const char *name = getenv("SNEK_TRACE");
+  if (!name) return;
+  close_frame();
+  int pid = hostBoard;
+  char path[256];
+  snprintf(path, sizeof(path), "%s.%s.json", name, hostName());
+  FILE *f = fopen(path, "w");
+  if (!f) {
+    perror(path);
+    return;
+  }
+  fprintf(f, "{\"traceEvents\":[\n");
+  fprintf(f, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,"
+      "\"args\":{\"name\":\"%s\"}}", pid, hostName());
+  for (uint8_t p = 0; p < PROFILE_PHASES; p++) {
+    fprintf(f, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,"
+        "\"tid\":%d,\"args\":{\"name\":\"%s\"}}", pid, p, phase_names[p]);
+  }
+  // a phase that ran more than once in a frame shows as one event at its
+  // first run, as long as its total
+  uint32_t first = frames > PROFILE_FRAMES ? frames - PROFILE_FRAMES : 0;
+  for (uint32_t i = first; i < frames; i++) {
+    const profile_frame_t *fr = &ring[i % PROFILE_FRAMES];
+    for (uint8_t p = 0; p < PROFILE_PHASES; p++) {
+      if (fr->offset[p] == PROFILE_NOT_RUN) continue;
+      fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,"
+          "\"ts\":%lu,\"dur\":%u,\"args\":{\"frame\":%lu}}",
+          phase_names[p], pid, p,
+          (unsigned long) (fr->start + fr->offset[p]), fr->us[p],
+          (unsigned long) i);
+    }
+  }
+  fprintf(f, "\n]}\n");
+  if (fclose(f) != 0) perror(path);
+}
+#endif
+
+#endif
@@ -0,0 +1,103 @@
+/*
+ * Per-phase frame profiler built on micros().
+ *
+ * Every game tick is a frame.  Code inside PROFILE_SCOPE(phase) adds its
+ * time to that phase of the current frame, and profile_frame() closes the
+ * frame, folds it into a per-phase histogram and keeps it in a ring of the
+ * last PROFILE_FRAMES frames.  The profiler is only compiled in when PROFILE
+ * is defined; otherwise the markers expand to nothing.
+ *
+ * Times come from profile_micros(), which is micros() stopped while the
+ * profiler does its own work, so its RAM checks on the board add nothing to
+ * the phases that enclose them.
+ */
+
+#ifndef _PROFILE_H
+#define _PROFILE_H
+
+#include <Arduino.h>
+
+// phases of a frame; PROFILE_TICK is the whole tick and includes the
+// phases that run inside it
+enum {
+  PROFILE_SERIAL,    // Serial2 packets in and out
+  PROFILE_JOYSTICK,  // sampling the joystick
+  PROFILE_UPDATE,    // Snake::update
+  PROFILE_COLLIDE,   // head-on and body collision checks
+  PROFILE_DRAW,      // flushing the draw queue to the display
+  PROFILE_TICK,      // the whole tick
+  PROFILE_PHASES
+};
+
+// frames kept for the trace, 28 bytes each
+#ifdef HOST
+#define PROFILE_FRAMES 4096
+#else
+#define PROFILE_FRAMES 8
+#endif
+
+// histogram bucket b counts frames where the phase took [2^(b-1), 2^b) us,
+// bucket 0 those where it did not run or took under 1 us; the last bucket
+// also takes anything longer
+#define PROFILE_BUCKETS 17
+
+// phase offset of a phase that did not run in the frame
+#define PROFILE_NOT_RUN 0xFFFF
+
+typedef struct {
+  uint32_t start;                   // profile_micros() when it started
+  uint16_t offset[PROFILE_PHASES];  // us from start to the phase's first run
+  uint16_t us[PROFILE_PHASES];      // total us spent in the phase
+} profile_frame_t;
+
+#ifdef PROFILE
+
+/* micros() less the time the profiler has spent on itself. */
+uint32_t profile_micros();
+
+/* Closes the current frame, if any, and starts the next one. */
+void profile_frame();
+
+/* Adds us microseconds, starting at profile_micros() start, to a phase of the
+ * current frame.  Ignored before the first profile_frame().
+ */
+void profile_add(uint8_t phase, uint32_t start, uint32_t us);
+
+/* Closes the current frame and prints each phase's average, maximum and
+ * histogram to port.  On the board it also prints the least free RAM seen
+ * at the end of each phase.
+ */
+void profile_dump(HardwareSerial &port);
+
+#ifdef HOST
+/* Host only: if SNEK_TRACE=name is set, closes the current frame and writes
+ * the frames still in the ring as a Chrome trace (chrome://tracing,
+ * Perfetto) to name.server.json or name.client.json, one row per phase.
+ */
+void profile_write_trace();
+#endif
+
+class ProfileScope {
+  public:
+    ProfileScope(uint8_t p) : phase(p), start(profile_micros()) {}
+    ~ProfileScope() { profile_add(phase, start, profile_micros() - start); }
+  private:
+    uint8_t phase;
+    uint32_t start;
+};
+
+// one scope variable per line, so scopes can nest in a block
+#define PROFILE_CAT_(a, b) a ## b
+#define PROFILE_CAT(a, b) PROFILE_CAT_(a, b)
+#define PROFILE_SCOPE(phase) ProfileScope PROFILE_CAT(profile_scope_, __LINE__)(phase)
+
+#else
+
+#define PROFILE_SCOPE(phase)
+#define profile_frame()
+#define profile_dump(port)
+#define profile_write_trace()
+
+#endif
+
+#endif
@@ -0,0 +1,241 @@
+/*
+ * Game recording and playback, see replay.h.
+ */
+
+#include <SPI.h>
+#include <SD.h>
+
+#include "replay.h"
+
+#ifdef REPLAY
+
+enum {REPLAY_NONE, REPLAY_RECORD, REPLAY_PLAY};
+
+static uint8_t mode;       // what the last replay_*_begin started
+static bool active;        // the file is open
+
+// the card, its volume and the replay file, see replay.h
+static Sd2Card card;
+static SdVolume volume;
+static SdFile file;
+static bool mounted;       // replay_begin() found the volume
+
+// the caller's buffer, see replay.h
+// recording: a ring of used bytes starting at buf[start]
+// playback: buf[pos, len) is what is left of the last read
+static uint8_t *buf;
+static uint16_t buf_size;
+static uint16_t start;
+static uint16_t used;
+static uint16_t pos;
+static int16_t len;
+
+static uint32_t last_tick;  // tick of the last record written or read
+static uint32_t bytes;      // bytes recorded or played
+static uint16_t stalls;     // times a record found the ring full
+
+// playback lookahead: the next record, if there is one
+static bool have_next;
+static uint32_t next_tick;
+static uint8_t next_event;
+
+/* ---- recording ---- */
+
+static void put(uint8_t b) {
+  buf[(start + used) % buf_size] = b;
+  used++;
+  bytes++;
+}
+
+// writes out the first n bytes of the ring, in two goes if it wraps
+static void write_out(uint16_t n) {
+  uint16_t first = min(n, (uint16_t)(buf_size - start));
+  file.write(buf + start, first);
+  if (n > first) file.write(buf, n - first);
+  start = (start + n) % buf_size;
+  used -= n;
+}
+
+// a record is at most 5 varint bytes and the event; if that does not fit
+// the ring is written out now, which can cost the tick a card write
+static void put_record(uint32_t tick, uint8_t event) {
+  if (buf_size - used < 6) {
+    write_out(used);
+    stalls++;
+  }
+  uint32_t delta = tick - last_tick;
+  last_tick = tick;
+  while (delta >= 0x80) {
+    put(0x80 | (delta & 0x7F));
+    delta >>= 7;
+  }
+  put(delta);
+  put(event);
+}
+
+bool replay_begin(uint8_t cs)
+{
+  mounted = card.init(SPI_HALF_SPEED, cs) && volume.init(&card);
+  return mounted;
+}
+
+// the root directory is only needed while a file is opened, so it is kept
+// on the stack rather than in static storage
+static bool open_file(const char *name, uint8_t flags) {
+  SdFile root;
+  return mounted && root.openRoot(&volume) && file.open(&root, name, flags);
+}
+
+bool replay_record_begin(const char *name, uint8_t players, uint8_t snakes,
+                         uint32_t seed, uint8_t *ring, uint16_t size)
+{
+  mode = REPLAY_RECORD;
+  buf = ring;
+  buf_size = size;
+  start = used = 0;
+  last_tick = bytes = stalls = 0;
+  active = open_file(name, O_WRITE | O_CREAT | O_TRUNC);
+  if (!active) return false;
+
+  replay_header_t header;
+  memcpy(header.magic, REPLAY_MAGIC, sizeof(header.magic));
+  header.version = REPLAY_VERSION;
+  header.players = players;
+  header.snakes = snakes;
+  header.reserved = 0;
+  header.seed = seed;
+  // straight out, so the file's first cluster is found before the game
+  file.write(&header, sizeof(header));
+  bytes = sizeof(header);
+  return true;
+}
+
+void replay_record_tick(uint32_t tick, const uint8_t *in, uint8_t players,
+                        bool grow)
+{
+  if (mode != REPLAY_RECORD || !active) return;
+  for (uint8_t p = 0; p < players; p++) {
+    if (in[p]) put_record(tick, (p << 4) | (in[p] & 0x0F));
+  }
+  if (grow) put_record(tick, REPLAY_EVENT_GROW);
+}
+
+void replay_record_end(uint32_t tick)
+{
+  if (mode != REPLAY_RECORD || !active) return;
+  put_record(tick, REPLAY_EVENT_END);
+  write_out(used);
+  file.close();
+  active = false;
+}
+
+void replay_idle()
+{
+  if (mode == REPLAY_RECORD && active && used) write_out(used);
+}
+
+/* ---- playback ---- */
+
+static int next_byte() {
+  if (pos == len) {
+    len = file.read(buf, buf_size);
+    pos = 0;
+    if (len <= 0) {
+      len = 0;
+      return -1;
+    }
+  }
+  bytes++;
+  return buf[pos++];
+}
+
+// reads the next record into the lookahead, or notes there is none
+static void read_record() {
+  uint32_t delta = 0;
+  uint8_t shift = 0;
+  int b;
+  have_next = false;
+  do {
+    if ((b = next_byte()) < 0 || shift > 28) return;
+    delta |= (uint32_t)(b & 0x7F) << shift;
+    shift += 7;
+  } while (b & 0x80);
+  if ((b = next_byte()) < 0) return;
+  last_tick += delta;
+  next_tick = last_tick;
+  next_event = b;
+  have_next = true;
+}
+
+bool replay_play_begin(const char *name, replay_header_t *hdr,
+                       uint8_t *ring, uint16_t size)
+{
+  mode = REPLAY_PLAY;
+  buf = ring;
+  buf_size = size;
+  pos = len = 0;
+  last_tick = bytes = stalls = 0;
+  have_next = false;
+  active = open_file(name, O_READ);
+  if (!active) return false;
+
+  uint8_t *p = (uint8_t *) hdr;
+  for (uint8_t i = 0; i < sizeof(*hdr); i++) {
+    int b = next_byte();
+    if (b < 0) break;
+    p[i] = b;
+  }
+  if (memcmp(hdr->magic, REPLAY_MAGIC, sizeof(hdr->magic)) != 0 ||
+      hdr->version != REPLAY_VERSION) {
+    replay_play_end();
+    return false;
+  }
+  read_record();
+  return true;
+}
+
+uint8_t replay_play_tick(uint32_t tick, uint8_t *in, uint8_t players)
+{
+  uint8_t flags = 0;
+  memset(in, 0, players);
+  while (have_next && next_tick == tick) {
+    uint8_t event = next_event;
+    if (event == REPLAY_EVENT_END) {
+      have_next = false;  // nothing after the end counts
+      return flags | REPLAY_END;
+    }
+    if (event == REPLAY_EVENT_GROW) {
+      flags |= REPLAY_GROW;
+    } else if ((event >> 4) < players) {
+      in[event >> 4] = event & 0x0F;
+    }
+    read_record();
+  }
+  return flags;
+}
+
+void replay_play_end()
+{
+  if (mode != REPLAY_PLAY || !active) return;
+  file.close();
+  active = false;
+}
+
+void replay_report(HardwareSerial &port)
+{
+  if (mode == REPLAY_NONE) return;
+  port.print(mode == REPLAY_RECORD ? F("Replay recorded: ")
+                                   : F("Replay played: "));
+  port.print(bytes);
+  port.print(F(" bytes, "));
+  port.print((unsigned int) ((bytes + REPLAY_SECTOR - 1) / REPLAY_SECTOR));
+  port.print(F(" sectors"));
+  if (stalls) {
+    port.print(F(", "));
+    port.print((unsigned int) stalls);
+    port.print(F(" early writes for a full ring"));
+  }
+  port.println();
+}
+
+#endif
@@ -0,0 +1,152 @@
+/*
+ * Game recording to the SD card and playback from it.
+ *
+ * A replay file is a header followed by one record per event:
+ *
+ *   ticks  event
+ *
+ * where ticks is the number of ticks since the previous record (the first
+ * counts from tick 0) as a varint, 7 bits a byte with the top bit set on
+ * every byte but the last, and event is one of
+ *
+ *   0ppp iiii  player p's input byte i for the tick, only when nonzero
+ *   1000 0000  REPLAY_EVENT_GROW, every snake grows this tick
+ *   1111 1111  REPLAY_EVENT_END, the game ended on this tick
+ *
+ * Most ticks have no events, so a whole game takes a few hundred bytes.
+ * Recording appends to a small RAM ring, and replay_idle() hands it on,
+ * from the time a frame has to spare, to the SD library.  The library
+ * fills its 512 byte block cache and writes the card a whole sector at a
+ * time, so a tick seldom waits on the card.  A record that finds the ring
+ * full writes it out there and then instead, and replay_report() counts
+ * how often that happened.  Playback reads through the same cache.
+ *
+ * The ring is a buffer the caller lends for the whole replay; the game
+ * lends its snapshot buffer, which only a client receiving a snapshot
+ * uses, and only a server records and a board playing back has no links.
+ * It needs room for one record, 6 bytes, and a tick's records fitting in
+ * it keeps the ticks from waiting on the card.
+ *
+ * The card is reached through the SD library's utility layer, whose card,
+ * volume and file live here in static storage; SD.open()'s File would
+ * allocate its SdFile on the heap.  The root directory is only opened on
+ * the stack while a file is.  That costs about 90 bytes with this file's
+ * own state, and another 523 in SdVolume's static block cache, which every
+ * volume shares.
+ *
+ * Those 610 or so bytes are estimates from the library's structures, not
+ * avr-size output, and the default board build (two snakes, PREDICT 0)
+ * has no room for them under RAM_BUDGET.  So the replay is only compiled
+ * in when REPLAY is defined; otherwise nothing is recorded, no replay
+ * begins and the card is left alone.  A REPLAY build of that configuration
+ * needs RAM_BUDGET raised to about 7800, which leaves the stack some 400
+ * bytes; check it on the board with avr-size and mem_report's stack peak
+ * before relying on it.
+ */
+
+#ifndef _REPLAY_H
+#define _REPLAY_H
+
+#include <Arduino.h>
+
+#define REPLAY_MAGIC "SNKR"
+#define REPLAY_VERSION 1
+
+// bytes the card writes at once
+#define REPLAY_SECTOR 512
+
+// event bytes
+#define REPLAY_EVENT_GROW 0x80
+#define REPLAY_EVENT_END  0xFF
+
+// what replay_play_tick() found for a tick
+#define REPLAY_GROW 0x01
+#define REPLAY_END  0x02
+
+typedef struct {
+  char magic[4];       // REPLAY_MAGIC
+  uint8_t version;     // REPLAY_VERSION
+  uint8_t players;     // snakes steered by input
+  uint8_t snakes;      // snakes in the game
+  uint8_t reserved;
+  uint32_t seed;       // computer snakes' random state at tick 0
+} replay_header_t;
+
+#ifdef REPLAY
+
+/* Sets up the card on chip select pin cs.  Returns false if there is no
+ * card or no FAT volume on it; recording and playback then fail to begin.
+ */
+bool replay_begin(uint8_t cs);
+
+/* Starts recording a game to a new file, replacing any old one, with the
+ * size bytes at ring as the recording ring until replay_record_end().
+ * Returns false if the file cannot be created; the other record calls then
+ * do nothing.
+ */
+bool replay_record_begin(const char *name, uint8_t players, uint8_t snakes,
+                         uint32_t seed, uint8_t *ring, uint16_t size);
+
+/* Records one tick: in holds each player's input byte for it, and grow is
+ * true if the snakes grew.  Ticks must be recorded in order.
+ */
+void replay_record_tick(uint32_t tick, const uint8_t *in, uint8_t players,
+                        bool grow);
+
+/* Records the end of the game at tick, writes out everything still in RAM
+ * and closes the file.
+ */
+void replay_record_end(uint32_t tick);
+
+/* Hands the records waiting in RAM to the SD library, which writes the
+ * card whenever that fills a sector.  Call when the game has time to
+ * spare.
+ */
+void replay_idle();
+
+/* Opens a replay for playback and reads its header into hdr, reading the
+ * file size bytes at a time into ring until replay_play_end().  Returns
+ * false if the file is missing or not a replay.
+ */
+bool replay_play_begin(const char *name, replay_header_t *hdr,
+                       uint8_t *ring, uint16_t size);
+
+/* Fills in with each player's input for tick, one more than the last tick
+ * played, and returns REPLAY_GROW if the snakes grew on it, REPLAY_END if
+ * the game ended on it, both or neither.  After the end every input is 0.
+ */
+uint8_t replay_play_tick(uint32_t tick, uint8_t *in, uint8_t players);
+
+/* Closes the replay being played. */
+void replay_play_end();
+
+/* Prints the bytes recorded or played, the card sectors they take and how
+ * often a record found the ring full.  Prints nothing if there was no
+ * replay.
+ */
+void replay_report(HardwareSerial &port);
+
+#else
+
+static inline bool replay_begin(uint8_t) { return false; }
+static inline bool replay_record_begin(const char *, uint8_t, uint8_t,
+                                       uint32_t, uint8_t *, uint16_t) {
+  return false;
+}
+static inline void replay_record_tick(uint32_t, const uint8_t *, uint8_t,
+                                      bool) {}
+static inline void replay_record_end(uint32_t) {}
+static inline void replay_idle() {}
+static inline bool replay_play_begin(const char *, replay_header_t *,
+                                     uint8_t *, uint16_t) {
+  return false;
+}
+static inline uint8_t replay_play_tick(uint32_t, uint8_t *, uint8_t) {
+  return 0;
+}
+static inline void replay_play_end() {}
+static inline void replay_report(HardwareSerial &) {}
+
+#endif
+
+#endif
@@ -6,10 +6,18 @@
 #include <stdlib.h>
 
 #include "mem_syms.h"
+#include "mem_watch.h"
+#include "joystick.h"
+#include "log.h"
+#include "packet.h"
+#include "profile.h"
+#include "replay.h"
 
 
 enum Direction {UP = 0, RIGHT = 1, DOWN = 2, LEFT = 3};
 enum Orientation {HORIZONTAL = 0, VERTICAL = 1, NEITHER = 2};
+//what became of a move given to a snake
+enum MoveResult {MOVE_QUEUED, MOVE_COALESCED, MOVE_DROPPED};
 
 // standard U of A library settings, assuming Atmel Mega SPI pins
 #define SD_CS    5  // Chip select line for SD card
@@ -22,85 +30,354 @@ const int VERT = 0;
 const int HOR = 1;
 const int SEL = 9; //joystick management
 
-// maximum index of an element in line segment array i.e. [0, maxSegs]
-#define maxSegs 30
+// play field on the 128x160 portrait display; snakes die on reaching the
+// last column or row, so those are never entered
+#define fieldWidth 127
+#define fieldHeight 159
+
+// line segments in each snake's ring buffer
+#define snakeSegs 31
+
+// clients playing on the server, each on its own serial port; every board
+// must be built with the same number
+#ifndef CLIENTS
+#define CLIENTS 1
+#endif
+#if CLIENTS < 1 || CLIENTS > 3
+#error "CLIENTS must be between 1 and 3"
+#endif
+// snake 0 is the server's player and snake n client n's
+#define numPlayers (CLIENTS + 1)
+
+// snakes in a game: the players' and the rest steered by the game itself;
+// build with -DSNAKES=n for more, each costs the board about 200 bytes of
+// RAM, 310 with PREDICT=6
+#ifndef SNAKES
+#define SNAKES numPlayers
+#endif
+#define maxSnakes 8
+#if SNAKES < numPlayers || SNAKES > maxSnakes
+#error "SNAKES must be between numPlayers and maxSnakes"
+#endif
 
 // is this arduino server or client
 bool isServer;
 int wait = 0;
 
+// the server's port to each client; a client always talks to the server on
+// Serial2, so client 1 is on Serial2 at both ends and two boards are wired
+// as they always were.  Only the ports in use are named, so the core leaves
+// the others' 157 bytes of buffers out of the link.
+HardwareSerial *const clientPorts[CLIENTS] = {
+  &Serial2,
+#if CLIENTS > 1
+  &Serial3,
+#endif
+#if CLIENTS > 2
+  &Serial1,
+#endif
+};
+
+// the replay file on the SD card: with REPLAY the server records every game
+// to it and a board reset with the joystick button held down plays it back
+#define replayFile "replay.rpl"
+
+// snake colours, players first; these tables stay in flash, read them with
+// pgm_read_word() and print the names through a __FlashStringHelper
+const uint16_t snakeColours[maxSnakes] PROGMEM = {
+  0xFF00, 0x0FF0, 0xF81F, 0x07FF, 0xFFE0, 0xF800, 0x001F, 0x07E0
+};
+// what the game over screen calls each player's snake
+const char playerNames[4][6] PROGMEM = {"BLUE", "GREEN", "PINK", "CYAN"};
+
+// one FNV-1a step, for the game state hash
+uint32_t hashByte(uint32_t h, uint8_t b){
+  return (h ^ b) * 16777619UL;
+}
+
 struct snakeSeg{
   uint8_t x1;
   uint8_t y1;
   uint8_t x2;
   uint8_t y2;
   uint8_t layer;
-  Direction dir; //information on each snake segment
+  uint8_t dir; //a Direction, information on each snake segment
 };
 
-class JoystickListener{
+// pixels a Bitboard changed, oldest first, with what they were before so
+// a rollback can put them back; the caller sizes changes for the most it
+// will make before undoing or forgetting them
+struct BitChange{
+  uint8_t x;
+  uint8_t y;
+  uint8_t layerWas; //layer in bit 0, the pixel's old value in bit 1
+};
+class BitLog{
+  public:
+    BitChange *changes;
+    uint8_t size;
+    uint8_t count;
+    void begin(BitChange *buf, uint8_t n){
+      changes = buf;
+      size = n;
+      count = 0;
+    }
+    void add(uint8_t layer, uint8_t x, uint8_t y, bool was){
+      if(count == size) return;
+      changes[count].x = x;
+      changes[count].y = y;
+      changes[count].layerWas = layer | was << 1;
+      count++;
+    }
+};
+
+// packed 1bpp map of the pixels covered by snake bodies, one plane per layer
+// of a W x H play field (the old server's board struct, but indexed row
+// first); rows follow on without padding, so an odd width wastes no bits
+template<uint8_t W, uint8_t H>
+class Bitboard{
   private:
-    int horizontalPin;
-    int verticalPin;
-    int depressionPin;
-    int verticalBaseline;
-    int horizontalBaseline;
-    int threshold; //initial thresholds for the joystick for reference
+    static const uint16_t planeBytes = ((uint32_t)W * H + 7) / 8;
+    uint8_t pixel[2][planeBytes];
+    //Returns the byte holding (x,y) and sets mask to its bit there
+    uint8_t &cellOf(uint8_t layer, uint8_t x, uint8_t y, uint8_t &mask){
+      uint16_t i = (uint16_t)y * W + x;
+      mask = 128 >> (i & 7);
+      return pixel[layer][i >> 3];
+    }
   public:
-    // Pass the joystickListener the pin numbers that the joystick is hooked up to as well as the minimum threshold for input.
-    JoystickListener(int vert, int hort, int sel, int thresh){
-      verticalPin = vert;
-      horizontalPin = hort;
-      depressionPin = sel; 
-      digitalWrite(depressionPin, HIGH);
-      verticalBaseline = analogRead(verticalPin);
-      horizontalBaseline = analogRead(horizontalPin);
-      threshold = thresh;
-    }
-    //Returns the value of the vertical pin
-    int getVertical(){
-      return analogRead(verticalPin);
-    }
-    //Returns the original baseline of the vertical pin
-    int getVerticalBaseline(){
-      return verticalBaseline;
-    }
-    //Returns the value of the horizontal pin
-    int getHorizontal(){
-      return analogRead(horizontalPin); 
-    }
-    //Returs the original baseline of the horizontal pin
-    int getHorizontalBaseline(){
-      return horizontalBaseline; 
-    }   
-    //Returns the state of the Joystick's button
-    boolean isDepressed(){
-      return !digitalRead(depressionPin); 
-    }
-    //Returns true if the joystick is pushed horizontally past the minimum threshold, false otherwise
-    boolean isPushedHorizontally(){
-      return (abs(horizontalBaseline - getHorizontal()) > threshold);
-    }
-    //Returns true if the joystick is pushed vertically past the minimum threshold, false otherwise
-    boolean isPushedVertically(){
-      return (abs(verticalBaseline - getVertical()) > threshold);
-    }
-    //Returns true if the joystick is pushed vertically or horiztonally, false if not pushed past either threshold.
-    boolean isPushed(){
-      return isPushedVertically() || isPushedHorizontally();
-    } 
+    //while set, testAndSet() and reset() note every pixel they touch
+    BitLog *log;
+    void clear(){
+      memset(pixel, 0, sizeof(pixel));
+    }
+    //Returns true if (x,y) on the given layer is covered by a snake
+    bool get(uint8_t layer, uint8_t x, uint8_t y){
+      uint8_t mask;
+      return cellOf(layer, x, y, mask) & mask;
+    }
+    void set(uint8_t layer, uint8_t x, uint8_t y){
+      uint8_t mask;
+      cellOf(layer, x, y, mask) |= mask;
+    }
+    void reset(uint8_t layer, uint8_t x, uint8_t y){
+      uint8_t mask;
+      uint8_t &cell = cellOf(layer, x, y, mask);
+      if(log) log->add(layer, x, y, cell & mask);
+      cell &= ~mask;
+    }
+    //Marks (x,y) as covered and returns whether it already was
+    bool testAndSet(uint8_t layer, uint8_t x, uint8_t y){
+      uint8_t mask;
+      uint8_t &cell = cellOf(layer, x, y, mask);
+      bool hit = cell & mask;
+      if(log) log->add(layer, x, y, hit);
+      cell |= mask;
+      return hit;
+    }
+    //Puts back every pixel in l, newest first, and empties it
+    void undo(BitLog &l){
+      while(l.count){
+        const BitChange &c = l.changes[--l.count];
+        uint8_t mask;
+        uint8_t &cell = cellOf(c.layerWas & 1, c.x, c.y, mask);
+        cell = (c.layerWas & 2) ? cell | mask : cell & ~mask;
+      }
+    }
 };
 
+// what the ST7735 driver clocks out over SPI: setting an address window is
+// CASET and RASET (a command and four data bytes each) plus RAMWR, and each
+// pixel is two bytes of colour; drawPixel pays for a window every time
+#define spiWindowBytes 11
+#define spiPixelBytes 2
+#define drawQueueSize 16
+
+// Pixel changes for one tick, sent to the display together by flush().
+// Pixels that end up next to each other on a row share one address window
+// and go out as a run of pushColor calls.
+class DrawQueue{
+  private:
+    struct pixel{
+      uint8_t x;
+      uint8_t y;
+      uint16_t colour;
+    };
+    pixel queue[drawQueueSize];
+    uint8_t count;
+  public:
+    uint32_t plotted; //pixels queued, each would be a drawPixel otherwise
+    uint32_t skipped; //pixels the caller knew were already on screen
+    uint32_t sent;    //bytes actually sent over SPI by flush()
+    bool muted;       //plots are dropped, a rollback draws what it changed
+
+    DrawQueue() : count(0), plotted(0), skipped(0), sent(0), muted(false) {}
+
+    //Queues (x,y) to be drawn; a later plot of the same pixel replaces it
+    void plot(uint8_t x, uint8_t y, uint16_t colour){
+      if(muted) return;
+      plotted++;
+      for(uint8_t i = 0; i < count; i++){
+        if(queue[i].x == x && queue[i].y == y){
+          queue[i].colour = colour;
+          return;
+        }
+      }
+      if(count == drawQueueSize){
+        flush();
+      }
+      queue[count].x = x;
+      queue[count].y = y;
+      queue[count].colour = colour;
+      count++;
+    }
+    //Draws everything queued, in row order, merging horizontal neighbours
+    void flush(){
+      //insertion sort by row then column, the queue is only a few pixels
+      for(uint8_t i = 1; i < count; i++){
+        pixel p = queue[i];
+        uint8_t j = i;
+        while(j > 0 && (queue[j-1].y > p.y ||
+              (queue[j-1].y == p.y && queue[j-1].x > p.x))){
+          queue[j] = queue[j-1];
+          j--;
+        }
+        queue[j] = p;
+      }
+      uint8_t i = 0;
+      while(i < count){
+        uint8_t end = i + 1;
+        while(end < count && queue[end].y == queue[i].y
+            && queue[end].x == queue[end-1].x + 1){
+          end++;
+        }
+        tft.setAddrWindow(queue[i].x, queue[i].y, queue[end-1].x, queue[i].y);
+        sent += spiWindowBytes + spiPixelBytes*(end - i);
+        for(; i < end; i++){
+          tft.pushColor(queue[i].colour);
+        }
+      }
+      count = 0;
+    }
+};
+
+// pixels changed this tick on the layer this arduino displays
+DrawQueue screen;
+
+// A snake's live segments in one list for each layer and axis, each sorted
+// by the row or column its segments run along, so a point query looks at
+// just the segments on its row and column; the sorted pivot bins of
+// old/lines.h, in a fixed array of ring indices. A segment keeps its row
+// or column from when the head starts it until the tail leaves it, so the
+// lists only change as segments come and go, and the ends are read from
+// the ring as they stand.
+//
+// Collisions are the occupancy bitboard's job, so the game only asks the
+// index what covers a pixel when a rollback redraws, and the board, which
+// has neither RAM nor time to spare for it, keeps the empty one further on
+// and walks the ring there instead.  The host keeps the index to bench it.
+#ifdef HOST
+template<uint8_t Segs>
+class SegmentIndex{
+  public:
+    // ring indices, the lists one after another
+    uint8_t order[Segs];
+    // where each list starts in order; start[lists] is the segment count
+    static const uint8_t lists = 4;
+    uint8_t start[lists + 1];
+
+    //Returns the list seg goes in, by its layer and then its axis
+    static uint8_t listOf(const snakeSeg &seg){
+      return seg.layer << 1 | (seg.dir & 1);
+    }
+    //Returns the row a level segment runs along, or an upright one's column
+    static uint8_t pivotOf(const snakeSeg &seg){
+      return (seg.dir & 1) ? seg.y1 : seg.x1;
+    }
+    static uint8_t listFor(uint8_t layer, bool level){
+      return layer << 1 | level;
+    }
+    void clear(){
+      memset(start, 0, sizeof(start));
+    }
+    //Adds segment i of segs, which must not be in already
+    void add(const snakeSeg *segs, uint8_t i){
+      uint8_t list = listOf(segs[i]);
+      uint8_t at = bound(segs, list, pivotOf(segs[i]) + 1);
+      memmove(order + at + 1, order + at, start[lists] - at);
+      order[at] = i;
+      for(uint8_t k = list + 1; k <= lists; k++) start[k]++;
+    }
+    //Takes segment i of segs out, before its slot in the ring is reused
+    void remove(const snakeSeg *segs, uint8_t i){
+      uint8_t list = listOf(segs[i]);
+      uint8_t at = bound(segs, list, pivotOf(segs[i]));
+      while(at < start[list + 1] && order[at] != i) at++;
+      if(at == start[list + 1]) return;
+      memmove(order + at, order + at + 1, start[lists] - at - 1);
+      for(uint8_t k = list + 1; k <= lists; k++) start[k]--;
+    }
+    //Sets [from, to) to where in order the segments of list running
+    //along pivot are
+    void find(const snakeSeg *segs, uint8_t list, uint8_t pivot,
+        uint8_t &from, uint8_t &to){
+      from = to = bound(segs, list, pivot);
+      while(to < start[list + 1] && pivotOf(segs[order[to]]) == pivot) to++;
+    }
+  private:
+    //Returns the first place in list whose pivot is at least pivot
+    uint8_t bound(const snakeSeg *segs, uint8_t list, uint16_t pivot){
+      uint8_t lo = start[list];
+      uint8_t hi = start[list + 1];
+      while(lo < hi){
+        uint8_t mid = (lo + hi) / 2;
+        if(pivotOf(segs[order[mid]]) < pivot){
+          lo = mid + 1;
+        }else{
+          hi = mid;
+        }
+      }
+      return lo;
+    }
+};
+#else
+template<uint8_t Segs>
+class SegmentIndex{
+  public:
+    void clear(){}
+    void add(const snakeSeg *, uint8_t){}
+    void remove(const snakeSeg *, uint8_t){}
+};
+#endif
+
+// A snake on a W x H play field with room for Segs line segments.  The
+// sizes are template arguments, so the wall and wrap checks on the hot path
+// compare against constants and the compiler folds them.
+template<uint8_t W, uint8_t H, uint8_t Segs>
 class Snake{
   public:
+    static const uint8_t width = W;
+    static const uint8_t height = H;
+    static const uint8_t capacity = Segs;
+    // moves a snake can have waiting
+    static const uint8_t maxMoves = 4;
+    // a queued layer jump; a queued turn is its Direction
+    static const uint8_t moveLayer = 4;
+
+    // occupancy of both layers, shared by every snake of this geometry
+    static Bitboard<W, H> occupied;
+
     // circular buffer containing all the line segments of the snake, with the form
     // x1,y1,x2,y2,layer,dir 
-    snakeSeg lineSegments[maxSegs + 1];
+    snakeSeg lineSegments[Segs];
 
     // indices of head and tail of snake
     uint8_t head;
     uint8_t tail;
 
+    // the live segments by layer, axis and row or column, on the host
+    SegmentIndex<Segs> index;
+
     //length management of the snakes
     //pending length is the difference between current length and goal length
     uint8_t pendingLength;
@@ -108,16 +385,28 @@ class Snake{
 
     uint16_t colour;
 
+    // moves given but not yet taken, oldest first; they wait here while
+    // the segment ring is full and the snake takes one a tick
+    uint8_t moves[maxMoves];
+    uint8_t numMoves;
+
     // current state of the life of the snake    
     boolean dead;
 
-    Snake(uint8_t startX, uint8_t startY, Direction startDir, uint16_t col, int startingLength) :
-      pendingLength(startingLength) {
+    // set by update() when the head moved onto an occupied pixel
+    boolean bumped;
+
+    // Places a new snake; snakes are static, so this takes the place of a
+    // constructor
+    void begin(uint8_t startX, uint8_t startY, Direction startDir,
+        uint16_t col, int startingLength){
         head = 0;
         tail = 0;
         colour = col;
         pendingLength = startingLength;
         dead = false;
+        bumped = false;
+        numMoves = 0;
         lineSegments[head].x1 = startX;
         lineSegments[head].y1 = startY;
         lineSegments[head].x2 = startX;
@@ -125,17 +414,19 @@ class Snake{
         lineSegments[head].dir = startDir;
         lineSegments[head].layer = 0;
         length = 1;
+        index.clear();
+        index.add(lineSegments, head);
       }
 
-    // safe incrementing of x and y as long as n < 255 - 127
+    // safe incrementing of x and y as long as n < 255 - max
     // don't initialize snake with more than 127 pending length
-    void incrSafe(uint8_t &x, uint8_t n, uint8_t max){
+    static void incrSafe(uint8_t &x, uint8_t n, uint8_t max){
       x += n;
       if(x >= max){
         x -= max;
       }
     }
-    void decrSafe(uint8_t &x, uint8_t n, uint8_t max){
+    static void decrSafe(uint8_t &x, uint8_t n, uint8_t max){
       if(x >= n){
         x -= n;
       }
@@ -148,6 +439,9 @@ class Snake{
       // updates head first and then tail
       // and checks to make sure snake is on screen.
 
+      uint8_t prevX = lineSegments[head].x2;
+      uint8_t prevY = lineSegments[head].y2;
+
       // head movement
       switch(lineSegments[head].dir){
         case LEFT:
@@ -155,38 +449,48 @@ class Snake{
             kill();
             break;
           }
-          decrSafe(lineSegments[head].x2, 1, 127);
+          decrSafe(lineSegments[head].x2, 1, width);
           break;
         case RIGHT:
-          if(lineSegments[head].x2 == 126) { 
+          if(lineSegments[head].x2 == width - 1) { 
             kill();
             break;
           }
-          incrSafe(lineSegments[head].x2, 1, 127);
+          incrSafe(lineSegments[head].x2, 1, width);
           break;
         case UP:
           if(lineSegments[head].y2 == 0) { 
             kill();
             break;
           }
-          decrSafe(lineSegments[head].y2, 1, 159);
+          decrSafe(lineSegments[head].y2, 1, height);
           break;
         case DOWN:
-          if(lineSegments[head].y2 == 158) { 
+          if(lineSegments[head].y2 == height - 1) { 
             kill();
             break;
           }
-          incrSafe(lineSegments[head].y2, 1, 159);
+          incrSafe(lineSegments[head].y2, 1, height);
           break;
       }
 
+      // claim the new head pixel; running into a wall leaves the head in place
+      bool headMoved = lineSegments[head].x2 != prevX
+        || lineSegments[head].y2 != prevY;
+      bool tailMoved = false;
+      if(headMoved){
+        bumped = occupied.testAndSet(lineSegments[head].layer,
+            lineSegments[head].x2, lineSegments[head].y2);
+      }
+
       // check to see if the tail is finished with going through this segment 
       // and empty segment and update tail if it is
       if(lineSegments[tail].x1 == lineSegments[tail].x2 && 
           lineSegments[tail].y1 == lineSegments[tail].y2){
         // free up the tail
         length--;
-        incrSafe(tail, 1, maxSegs);
+        index.remove(lineSegments, tail);
+        incrSafe(tail, 1, capacity);
       }
 
       // tail movement waits pendingLength head moves before starting tail movement
@@ -194,38 +498,43 @@ class Snake{
         pendingLength --;
       }
       else{
+        tailMoved = true;
         switch(lineSegments[tail].dir){
           case LEFT:
-            decrSafe(lineSegments[tail].x1, 1, 127);
+            decrSafe(lineSegments[tail].x1, 1, width);
             break;
           case RIGHT:
-            incrSafe(lineSegments[tail].x1, 1, 127);
+            incrSafe(lineSegments[tail].x1, 1, width);
             break;
           case UP:
-            decrSafe(lineSegments[tail].y1, 1, 159);
+            decrSafe(lineSegments[tail].y1, 1, height);
             break;
           case DOWN:
-            incrSafe(lineSegments[tail].y1, 1, 159);
+            incrSafe(lineSegments[tail].y1, 1, height);
             break;
         }
+        // the pixel the tail moved onto was drawn by the head on this layer
+        occupied.reset(lineSegments[tail].layer,
+            lineSegments[tail].x1, lineSegments[tail].y1);
       }
 
-      // draw head and tail pixels if they are on the correct layer
-      // otherwise send drawing info to client
-      if(isServer){
-        if(lineSegments[head].layer == 0){
-          tft.drawPixel(lineSegments[head].x2, lineSegments[head].y2, colour);
-        }
-        if(lineSegments[tail].layer == 0){
-          tft.drawPixel(lineSegments[tail].x1, lineSegments[tail].y1, 0x0);
+      // queue head and tail pixels if they are on the layer this arduino
+      // shows, the server shows layer 0 and the client layer 1
+      // an end that did not move has nothing new to draw, and erasing a
+      // tail that stayed put could wipe another snake's head off that pixel
+      uint8_t shownLayer = isServer ? 0 : 1;
+      if(lineSegments[head].layer == shownLayer){
+        if(headMoved){
+          screen.plot(lineSegments[head].x2, lineSegments[head].y2, colour);
+        }else{
+          screen.skipped++;
         }
       }
-      else{
-        if(lineSegments[head].layer == 1){
-          tft.drawPixel(lineSegments[head].x2, lineSegments[head].y2, colour);
-        }
-        if(lineSegments[tail].layer == 1){
-          tft.drawPixel(lineSegments[tail].x1, lineSegments[tail].y1, 0x0);
+      if(lineSegments[tail].layer == shownLayer){
+        if(tailMoved){
+          screen.plot(lineSegments[tail].x1, lineSegments[tail].y1, 0x0);
+        }else{
+          screen.skipped++;
         }
       }
     }
@@ -235,7 +544,7 @@ class Snake{
       length++;
 
       uint8_t prevHead = head;
-      incrSafe(head, 1, maxSegs);
+      incrSafe(head, 1, capacity);
       lineSegments[head].x1 = lineSegments[prevHead].x2;
       lineSegments[head].y1 = lineSegments[prevHead].y2;
       lineSegments[head].x2 = lineSegments[head].x1;
@@ -243,6 +552,7 @@ class Snake{
       lineSegments[head].layer = lineSegments[prevHead].layer;
       lineSegments[head].dir = newDir;
       //assign info to line segments for tail to follow
+      index.add(lineSegments, head);
     }
     void setLayer(uint8_t newLayer){
       if(queueFull()) { return; } //user moved too much
@@ -250,7 +560,7 @@ class Snake{
       length++;
 
       uint8_t prevHead = head;
-      incrSafe(head, 1, maxSegs);
+      incrSafe(head, 1, capacity);
       lineSegments[head].x1 = lineSegments[prevHead].x2;
       lineSegments[head].y1 = lineSegments[prevHead].y2;
       lineSegments[head].x2 = lineSegments[head].x1;
@@ -258,6 +568,53 @@ class Snake{
       lineSegments[head].layer = newLayer; 
       lineSegments[head].dir = lineSegments[prevHead].dir;
       //assign info to line segments for tail to follow
+      index.add(lineSegments, head);
+    }
+    //Returns the direction the snake heads in once its moves are taken
+    Direction plannedDirection(){
+      for(uint8_t k = numMoves; k-- > 0; ){
+        if(moves[k] != moveLayer) return (Direction)moves[k];
+      }
+      return getDirection();
+    }
+    //Queues a turn. A turn still waiting gives way to a later one on the
+    //same axis, and a turn along the way the snake will be heading, or
+    //back into itself, does nothing
+    MoveResult queueTurn(Direction dir){
+      if(numMoves && moves[numMoves - 1] != moveLayer
+          && moves[numMoves - 1] % 2 == dir % 2){
+        numMoves--;
+        if(dir % 2 != plannedDirection() % 2) moves[numMoves++] = dir;
+        return MOVE_COALESCED;
+      }
+      if(dir % 2 == plannedDirection() % 2) return MOVE_COALESCED;
+      if(numMoves == maxMoves) return MOVE_DROPPED;
+      moves[numMoves++] = dir;
+      return MOVE_QUEUED;
+    }
+    //Queues a jump to the other layer; two in a row cancel out
+    MoveResult queueLayer(){
+      if(numMoves && moves[numMoves - 1] == moveLayer){
+        numMoves--;
+        return MOVE_COALESCED;
+      }
+      if(numMoves == maxMoves) return MOVE_DROPPED;
+      moves[numMoves++] = moveLayer;
+      return MOVE_QUEUED;
+    }
+    //Takes the oldest queued move if the segment ring has room. One move a
+    //step gives every segment at least the pixel the head moves onto next,
+    //so the tail never finds two empty segments in a row to run off along
+    void takeMoves(){
+      if(!numMoves || queueFull()) return;
+      uint8_t move = moves[0];
+      numMoves--;
+      memmove(moves, moves + 1, numMoves);
+      if(move == moveLayer){
+        setLayer(getLayer() ? 0 : 1);
+      }else{
+        setDirection((Direction)move);
+      }
     }
     bool intersects(uint8_t X, uint8_t Y, uint8_t x1, uint8_t y1, uint8_t x2, uint8_t y2){
       //determines if perpendicular lines intersect
@@ -273,7 +630,7 @@ class Snake{
       uint8_t tmpX2 = lineSegments[i].x2;
       uint8_t tmpY1 = lineSegments[i].y1;
       uint8_t tmpY2 = lineSegments[i].y2;
-      Direction tmpDir = lineSegments[i].dir;
+      Direction tmpDir = (Direction)lineSegments[i].dir;
       if(layer == lineSegments[i].layer){
         if(tmpDir % 2 != dir % 2){
           if(intersects(x, y, tmpX1, tmpY1, tmpX2, tmpY2)) return true;
@@ -289,23 +646,39 @@ class Snake{
       }
       return false;
     }
+    //Returns true if the last update moved the head onto an occupied pixel
+    bool hasCollided(){
+      return bumped;
+    }
     bool willCollide(uint8_t x, uint8_t y, Direction dir, uint8_t layer){
       //checks if (x,y) will collide with any part of this snake
-      if(head > tail){
-        for(uint8_t i = tail; i < head; i++){
-          if(checkLine(x, y, i, dir, layer)) return true;
-        }
+      //by walking the segments; the game uses the occupancy bitboard instead.
+      //The walk goes from tail to head, both included, over the live part
+      //of the ring. It used to stop short of the head segment, and once the
+      //ring had wrapped it walked the free slots from head to tail instead
+      //of the body
+      for(uint8_t i = tail; ; incrSafe(i, 1, capacity)){
+        if(checkLine(x, y, i, dir, layer)) return true;
+        if(i == head) break;
       }
-      else if(head == tail){
-        if(checkLine(x, y, head, dir, layer)) return true;
+      return false;
+    }
+#ifdef HOST
+    //Same as willCollide, but only looks at the segments along x's column
+    //and y's row, from the index
+    bool willCollideIndexed(uint8_t x, uint8_t y, Direction dir, uint8_t layer){
+      uint8_t from, to;
+      index.find(lineSegments, index.listFor(layer, false), x, from, to);
+      for(; from < to; from++){
+        if(checkLine(x, y, index.order[from], dir, layer)) return true;
       }
-      else{
-        for(uint8_t i = head; i < tail; i++){
-          if(checkLine(x, y, i, dir, layer)) return true;
-        }
+      index.find(lineSegments, index.listFor(layer, true), y, from, to);
+      for(; from < to; from++){
+        if(checkLine(x, y, index.order[from], dir, layer)) return true;
       }
       return false;
     }
+#endif
     uint8_t getX(){
       return lineSegments[head].x2;
     }
@@ -325,7 +698,7 @@ class Snake{
       return lineSegments[tail].y1;
     }
     Direction getDirection(){
-      return lineSegments[head].dir;
+      return (Direction)lineSegments[head].dir;
     }
     uint8_t getLayer(){
       return lineSegments[head].layer;
@@ -337,7 +710,7 @@ class Snake{
       return length;
     }
     bool queueFull(){
-      return((head == maxSegs && tail == 0) || (head + 1 == tail));
+      return (head + 1 == capacity ? 0 : head + 1) == tail;
     }
     void kill(){
       wait = 15;
@@ -346,290 +719,1983 @@ class Snake{
     boolean isDead(){
       return dead;  
     }
+    //Folds what decides the snake's next moves into hash h: the ring
+    //indices, lengths, flags, both ends and the moves waiting
+    uint32_t hash(uint32_t h){
+      const snakeSeg &first = lineSegments[tail];
+      const snakeSeg &last = lineSegments[head];
+      uint8_t bytes[13] = {head, tail, length, pendingLength,
+        (uint8_t)(dead | bumped << 1),
+        first.x1, first.y1, first.layer, first.dir,
+        last.x2, last.y2, last.layer, last.dir};
+      for(uint8_t i = 0; i < sizeof(bytes); i++) h = hashByte(h, bytes[i]);
+      h = hashByte(h, numMoves);
+      for(uint8_t i = 0; i < numMoves; i++) h = hashByte(h, moves[i]);
+      return h;
+    }
+
+    // most bytes encode() writes
+    static const uint8_t maxEncoded = 7 + maxMoves + 2 * Segs;
+
+    //Moves (x,y) n pixels towards dir
+    static void step(uint8_t &x, uint8_t &y, uint8_t dir, uint8_t n){
+      switch(dir){
+        case LEFT: decrSafe(x, n, width); break;
+        case RIGHT: incrSafe(x, n, width); break;
+        case UP: decrSafe(y, n, height); break;
+        case DOWN: incrSafe(y, n, height); break;
+      }
+    }
+    //Returns the pixels from a segment's start to its end
+    static uint8_t run(const snakeSeg &seg){
+      return seg.dir % 2 ? abs(seg.x2 - seg.x1) : abs(seg.y2 - seg.y1);
+    }
+    //Writes the snake compactly to out: head and tail indices,
+    //pendingLength, flags, the tail's start and the moves waiting with
+    //their count, then for each segment from the tail its direction and
+    //layer in one byte and its length in another; returns the bytes
+    //written
+    uint8_t encode(uint8_t *out){
+      uint8_t n = 0;
+      out[n++] = head;
+      out[n++] = tail;
+      out[n++] = pendingLength;
+      out[n++] = dead | bumped << 1;
+      out[n++] = lineSegments[tail].x1;
+      out[n++] = lineSegments[tail].y1;
+      out[n++] = numMoves;
+      memcpy(out + n, moves, numMoves);
+      n += numMoves;
+      for(uint8_t i = tail; ; incrSafe(i, 1, capacity)){
+        const snakeSeg &seg = lineSegments[i];
+        out[n++] = seg.dir | seg.layer << 2;
+        out[n++] = run(seg);
+        if(i == head) break;
+      }
+      return n;
+    }
+    //Returns how many bytes encode() wrote for the snake whose encoding
+    //starts with in
+    static uint8_t encodedSize(const uint8_t *in){
+      return 7 + in[6] + 2 * ((in[0] + capacity - in[1]) % capacity + 1);
+    }
+    //Takes the state encode() wrote; returns false and leaves the snake
+    //alone if it does not fit the field
+    bool decode(const uint8_t *in){
+      if(in[0] >= capacity || in[1] >= capacity) return false;
+      uint8_t x = in[4];
+      uint8_t y = in[5];
+      if(x >= width || y >= height || in[6] > maxMoves) return false;
+      for(uint8_t k = 0; k < in[6]; k++){
+        if(in[7 + k] > moveLayer) return false;
+      }
+      const uint8_t *p = in + 7 + in[6];
+      //every segment has to end on the field
+      for(uint8_t i = in[1]; ; incrSafe(i, 1, capacity), p += 2){
+        uint8_t n = p[1];
+        switch(p[0] & 3){
+          case LEFT: if(n > x) return false; x -= n; break;
+          case RIGHT: if(n >= width - x) return false; x += n; break;
+          case UP: if(n > y) return false; y -= n; break;
+          default: if(n >= height - y) return false; y += n; break;
+        }
+        if(i == in[0]) break;
+      }
+      x = in[4];
+      y = in[5];
+      head = in[0];
+      tail = in[1];
+      pendingLength = in[2];
+      dead = in[3] & 1;
+      bumped = (in[3] >> 1) & 1;
+      numMoves = in[6];
+      memcpy(moves, in + 7, numMoves);
+      p = in + 7 + numMoves;
+      length = 0;
+      index.clear();
+      for(uint8_t i = tail; ; incrSafe(i, 1, capacity), p += 2){
+        snakeSeg &seg = lineSegments[i];
+        seg.dir = p[0] & 3;
+        seg.layer = (p[0] >> 2) & 1;
+        seg.x1 = x;
+        seg.y1 = y;
+        step(x, y, seg.dir, p[1]);
+        seg.x2 = x;
+        seg.y2 = y;
+        index.add(lineSegments, i);
+        length++;
+        if(i == head) break;
+      }
+      return true;
+    }
+    //Returns true if (x,y) on layer is one of the pixels claim() would mark
+    bool covers(uint8_t layer, uint8_t x, uint8_t y){
+#ifdef HOST
+      //only the segments along x's column and y's row
+      uint8_t from, to;
+      index.find(lineSegments, index.listFor(layer, false), x, from, to);
+      for(; from < to; from++){
+        if(segmentCovers(lineSegments[index.order[from]], x, y)) return true;
+      }
+      index.find(lineSegments, index.listFor(layer, true), y, from, to);
+      for(; from < to; from++){
+        if(segmentCovers(lineSegments[index.order[from]], x, y)) return true;
+      }
+      return false;
+#else
+      return coversWalk(layer, x, y);
+#endif
+    }
+    //Same as covers(), but walks every segment
+    bool coversWalk(uint8_t layer, uint8_t x, uint8_t y){
+      for(uint8_t i = tail; ; incrSafe(i, 1, capacity)){
+        const snakeSeg &seg = lineSegments[i];
+        if(seg.layer == layer && segmentCovers(seg, x, y)) return true;
+        if(i == head) break;
+      }
+      return false;
+    }
+    //Returns true if (x,y) is on seg, past its start
+    static bool segmentCovers(const snakeSeg &seg, uint8_t x, uint8_t y){
+      if(seg.dir & 1){
+        return y == seg.y1 && x != seg.x1
+          && x >= min(seg.x1, seg.x2) && x <= max(seg.x1, seg.x2);
+      }
+      return x == seg.x1 && y != seg.y1
+        && y >= min(seg.y1, seg.y2) && y <= max(seg.y1, seg.y2);
+    }
+    //Marks the pixels the snake covers as occupied, each segment's from
+    //just past its start to its end as update() claimed them, and queues
+    //the ones on shownLayer to be drawn
+    void claim(uint8_t shownLayer){
+      for(uint8_t i = tail; ; incrSafe(i, 1, capacity)){
+        const snakeSeg &seg = lineSegments[i];
+        uint8_t x = seg.x1;
+        uint8_t y = seg.y1;
+        while(x != seg.x2 || y != seg.y2){
+          step(x, y, seg.dir, 1);
+          occupied.set(seg.layer, x, y);
+          if(seg.layer == shownLayer) screen.plot(x, y, colour);
+        }
+        if(i == head) break;
+      }
+    }
 };
 
+template<uint8_t W, uint8_t H, uint8_t Segs>
+Bitboard<W, H> Snake<W, H, Segs>::occupied;
+
+// the snakes in this game
+typedef Snake<fieldWidth, fieldHeight, snakeSegs> GameSnake;
+
 const int fps = 30; //frame rate during gameplay
 
+// ticks that may run back to back to catch up after a late one; once a
+// tick is later than that, the missed ones are dropped instead. 0 never
+// catches up
+const uint8_t maxCatchUp = 3;
+
+//Fixed timestep in microseconds. Each deadline is the previous one plus
+//the period, not the time the last tick ran plus the period, so a late
+//tick does not push back every tick after it. 1000000/fps does not
+//divide evenly, the remainder is carried so fps ticks take exactly 1 s.
+class Scheduler{
+  private:
+    uint32_t next; //micros() the next tick is due
+    uint32_t last; //micros() the last tick ran
+    uint16_t carry; //remainder of 1000000/fps owed to the deadlines
+    uint8_t behind; //catch-up ticks run back to back so far
+    uint32_t periodSum; //over ticks since begin, in us; wraps after ~70 min
+    void advance(){
+      next += 1000000UL / fps;
+      carry += 1000000UL % fps;
+      if(carry >= fps){
+        carry -= fps;
+        next++;
+      }
+    }
+  public:
+    uint32_t ticks; //ticks run since begin
+    uint32_t minPeriod; //shortest time between two ticks, in us
+    uint32_t maxPeriod; //longest time between two ticks, in us
+    uint32_t overruns; //ticks that started a whole period or more late
+    uint32_t dropped; //ticks given up on to get back on schedule
+    //Starts the schedule with the first tick due now
+    void begin(){
+      next = micros();
+      carry = 0;
+      behind = 0;
+      periodSum = 0;
+      ticks = 0;
+      minPeriod = 0xFFFFFFFF;
+      maxPeriod = 0;
+      overruns = 0;
+      dropped = 0;
+    }
+    bool due(){
+      return (int32_t)(micros() - next) >= 0;
+    }
+    //Call as each tick starts, to set the next deadline
+    void tick(){
+      uint32_t now = micros();
+      if(ticks){
+        uint32_t period = now - last;
+        periodSum += period;
+        if(period < minPeriod) minPeriod = period;
+        if(period > maxPeriod) maxPeriod = period;
+      }
+      last = now;
+      ticks++;
+      uint32_t late = now - next;
+      advance();
+      if(late < 1000000UL / fps){
+        behind = 0;
+        return;
+      }
+      overruns++;
+      if(behind < maxCatchUp){
+        behind++; //the next tick is due already, run it straight away
+        return;
+      }
+      //too far behind, drop the missed ticks and start again from now
+      dropped += late / (1000000UL / fps);
+      next = now;
+      carry = 0;
+      advance();
+      behind = 0;
+    }
+    //Returns the mean time between ticks, in us
+    uint32_t avgPeriod(){
+      return ticks > 1 ? periodSum / (ticks - 1) : 0;
+    }
+};
+
+// Lockstep: every tick each client sends the server its input tagged with
+// the tick it applies to. Once the server has every player's input for a
+// tick it sends all of them to every client in one packet, and tick N only
+// runs once all the inputs for N are in, so every board simulates the same
+// game. Clients never talk to each other. Local input is scheduled
+// inputDelay ticks ahead to hide the link latency; with lockstep off,
+// which only works with one client, input is applied immediately and
+// kills are sent as events.
+const bool lockstep = true;
+#define inputDelay 2
+// ticks a board may run ahead of the inputs it has, taking any it lacks as
+// empty; a late input that was not empty rolls the game back to the last
+// tick it had every input for and runs it forward again. 0 waits instead,
+// which the board build does until the rollback state's RAM has been
+// measured against RAM_BUDGET; PREDICT=6 turns it on, as the host build does
+#ifndef PREDICT
+#define PREDICT 0
+#endif
+#define maxPredict PREDICT
+// must be larger than maxPredict + 2*inputDelay + 1, the furthest a board
+// can get ahead
+#define inputWindow 16
+#if maxPredict + 2*inputDelay + 1 >= inputWindow
+#error "inputWindow too small for inputDelay and maxPredict"
+#endif
+// ms without a tick before a board sends its last tick packets again, in
+// case the ones the others are waiting on were lost, and how many: as far
+// as a board's inputs can run ahead of the tick another is stuck on
+#define resendTimeout 100
+#define resendTicks (maxPredict + inputDelay + 1)
+
+// event byte for one tick, sent in the payload of a PACKET_TICK
+// the input bits are for one player's snake: the sender's in a client's
+// packet, and in the server's each player's in turn
+#define inputDir   0x03 //Direction of the turn
+#define inputTurn  0x04 //turn towards inputDir
+#define inputLayer 0x08 //jump to the other layer
+#define eventKill(i) (0x10 << (i)) //snake i died, only sent without lockstep
+
+// ticks between game state checks: the server sends the clients a hash of
+// its state before every hashInterval'th tick and a client whose own hash
+// differs asks for the server's snakes
+#define hashInterval 16
+// snake state bytes in a PACKET_STATE, after its tick, snake and offset
+#define stateChunk (PACKET_MAX_PAYLOAD - 3)
+// the snake field of the PACKET_STATE that ends a resync: it carries the
+// growth counter, wait and the computer snakes' random state
+#define stateCommit 0xFF
+// ms a server waits for a client to say it took a snapshot before sending
+// another; a client gives up on a snapshot and asks again after
+// resendTimeout without a part of it, so it asks first
+#define snapshotTimeout 300
+
+// handshake resend timeouts in ms; the first covers a HELLO/WELCOME round
+// trip at 9600 baud, each timeout after that doubles up to the cap
+#define linkFirstTimeout 20
+#define linkMaxTimeout 640
+
+// link rates, lowest first: the handshake runs at the first and the server
+// then steps each link up as far as it passes a probe at each rate. 230400
+// is left out, the Mega's 16 MHz clock misses it by 3.5%
+const uint32_t linkRates[] PROGMEM = {9600, 115200, 250000, 500000, 1000000};
+#define linkSteps (sizeof(linkRates) / sizeof(linkRates[0]))
+// the rate of a step, from the table in flash
+uint32_t linkRate(uint8_t step){
+  return pgm_read_dword(&linkRates[step]);
+}
+// the debug console's rate
+#define consoleBaud 115200
+
+// the op in the first byte of a PACKET_BAUD, and who sends it
+#define BAUD_PROPOSE 0 //server: switch to a step, probed or not
+#define BAUD_ACK     1 //client: switching now
+#define BAUD_PROBE   2 //server: a probe packet at the new step
+#define BAUD_REPORT  3 //client: probes that arrived intact, CRC errors
+#define BAUD_KEEP    4 //server: the new step stays
+#define BAUD_KEPT    5 //client: the KEEP arrived
+#define BAUD_DOWN    6 //client: too many CRC errors at this step
+
+// probes sent at a rate on trial, every one of which has to arrive intact;
+// they go out probeGap ms apart, so a board polling its link every
+// millisecond or so never has more than two in its 64 byte receive ring
+#define probePackets 8
+#define probeBytes 24
+#define probeGap 2
+// ms a board waits at a rate on trial to hear it works before going back
+// to the last rate that did; the server waits longer, so it still hears
+// the client's answer to a KEEP the client got at the last moment
+#define trialTimeout 100
+#define trialServerTimeout 150
+// a link with linkMaxErrors CRC errors within linkErrorWindow good packets
+// drops a step
+#define linkErrorWindow 64
+#define linkMaxErrors 4
+
+enum LinkState {LINK_LISTEN, LINK_HELLO, LINK_WELCOME, LINK_UP};
+enum BaudState {BAUD_STEADY, BAUD_PROPOSED, BAUD_PROBING, BAUD_KEEPING,
+  BAUD_TRIAL};
+
+//Connection setup between the server and one client, polled from the main
+//loop so it never blocks. The client sends HELLO with a fresh nonce, the
+//server answers WELCOME with both nonces and the client's snake, and the
+//client confirms with READY. Unanswered packets are resent with exponential
+//backoff, and packets whose nonce does not match are left over from an
+//older attempt and ignored.
+//Once the link is up the server moves it to a faster rate one step at a
+//time: it PROPOSEs a step, the client ACKs and switches, the server
+//switches on the ACK and sends probes the client REPORTs on, and if they
+//all came through the server sends KEEP and the client answers KEPT. A
+//board that does not hear the rate works in time goes back to the last one
+//that did. The first step that fails ends the climb, and during play a
+//link that starts failing CRCs drops back a step the same way, unprobed.
+class Link{
+  private:
+    LinkState state;
+    bool server;
+    HardwareSerial *port;
+    const packet_parser_t *rx; //the link's parser, for its CRC errors
+    uint16_t clientNonce;
+    uint16_t serverNonce;
+    uint8_t snake; //the client's snake
+    uint32_t started; //millis() at begin
+    uint32_t sentAt; //millis() of the last HELLO or WELCOME
+    uint16_t timeout; //ms from sentAt until the next resend
+    BaudState baudState;
+    uint8_t step; //linkRates index the link runs at
+    uint8_t lastStep; //the step to go back to if a trial fails
+    uint8_t target; //the step proposed or on trial
+    bool probed; //the step on trial is probed
+    bool climbing; //server: still stepping the rate up
+    uint32_t baudAt; //millis() of the last baud packet resend
+    uint32_t trialAt; //millis() the rate on trial was switched to
+    uint16_t trialErrors; //rx->crc_errors at trialAt
+    uint8_t probes; //server: probes sent, client: intact ones, at the rate on trial
+    uint16_t windowGood; //good packets since windowErrors
+    uint16_t windowErrors; //rx->crc_errors at the start of the window
+    static uint8_t probeByte(uint8_t seq, uint8_t i){
+      return (seq * 37 + i * 73) ^ (i & 1 ? 0xA5 : 0x5A);
+    }
+    void sendBaud(uint8_t op, uint8_t a = 0, uint8_t b = 0){
+      uint8_t payload[4] = {op, target, a, b};
+      packet_send(*port, PACKET_BAUD, payload,
+          op == BAUD_PROPOSE ? 3 : op == BAUD_REPORT ? 4 : 2);
+      baudAt = millis();
+    }
+    //Switches the port to step once everything sent at the old rate is out
+    void setStep(uint8_t to){
+      port->flush();
+      port->begin(linkRate(to));
+      step = to;
+      if(step > bestStep) bestStep = step;
+      LOG(BAUD, linkRate(step), snake, 0);
+      restartWindow();
+    }
+    void restartWindow(){
+      windowGood = 0;
+      windowErrors = rx->crc_errors;
+    }
+    //Server: asks the client to move to step to
+    void propose(uint8_t to, bool probe){
+      target = to;
+      probed = probe;
+      baudState = BAUD_PROPOSED;
+      sendBaud(BAUD_PROPOSE, probe);
+    }
+    //Server: sends the next probe at the rate on trial
+    void sendProbe(){
+      uint8_t payload[3 + probeBytes] = {BAUD_PROBE, target, probes};
+      for(uint8_t i = 0; i < probeBytes; i++){
+        payload[3 + i] = probeByte(probes, i);
+      }
+      packet_send(*port, PACKET_BAUD, payload, sizeof(payload));
+      probes++;
+      baudAt = millis();
+    }
+    //Server: the rate on trial stays once the client has heard so
+    void keep(){
+      baudState = BAUD_KEEPING;
+      sendBaud(BAUD_KEEP);
+    }
+    //Goes back to the last rate that worked
+    void revert(){
+      trialsFailed++;
+      LOG(BAUD_FAILED, linkRate(step), snake, 0);
+      baudState = BAUD_STEADY;
+      climbing = false;
+      setStep(lastStep);
+    }
+    //Switches to the step proposed, which is on trial from here
+    void startTrial(){
+      lastStep = step;
+      setStep(target);
+      trialAt = millis();
+      trialErrors = rx->crc_errors;
+      probes = 0;
+    }
+    //Server: the trial passed, carries on up or settles
+    void kept(){
+      baudState = BAUD_STEADY;
+      restartWindow();
+      if(climbing && step + 1 < (int)linkSteps){
+        propose(step + 1, true);
+      }else{
+        climbing = false;
+      }
+    }
+    //Drops a step, or asks the server to, after too many CRC errors
+    void fallBack(){
+      restartWindow();
+      if(!step) return;
+      LOG(BAUD_ERRORS, linkRate(step), snake, 0);
+      if(server){
+        fallbacks++;
+        propose(step - 1, false);
+      }else{
+        target = step;
+        sendBaud(BAUD_DOWN);
+      }
+    }
+    //Acts on a PACKET_BAUD from the other arduino
+    void receiveBaud(const packet_t *pkt){
+      if(state != LINK_UP || pkt->len < 2) return;
+      uint8_t op = pkt->data[0];
+      uint8_t to = pkt->data[1];
+      if(to >= linkSteps) return;
+      if(server){
+        if(op == BAUD_ACK && baudState == BAUD_PROPOSED && to == target){
+          startTrial();
+          if(!probed){
+            keep();
+            return;
+          }
+          baudState = BAUD_PROBING;
+          sendProbe();
+        }else if(op == BAUD_REPORT && baudState == BAUD_PROBING
+            && to == target && pkt->len == 4){
+          if(pkt->data[2] == probePackets && !pkt->data[3]
+              && rx->crc_errors == trialErrors){
+            keep();
+          }else{
+            revert();
+          }
+        }else if(op == BAUD_KEPT && baudState == BAUD_KEEPING && to == target){
+          kept();
+        }else if(op == BAUD_DOWN && baudState == BAUD_STEADY && to == step){
+          fallBack();
+        }
+        return;
+      }
+      if(op == BAUD_PROPOSE && baudState == BAUD_STEADY && pkt->len == 3){
+        //answered at the old rate, everything after at the new one
+        target = to;
+        sendBaud(BAUD_ACK);
+        startTrial();
+        baudState = BAUD_TRIAL;
+      }else if(op == BAUD_PROBE && baudState == BAUD_TRIAL && to == target
+          && pkt->len == 3 + probeBytes){
+        bool intact = true;
+        for(uint8_t i = 0; i < probeBytes; i++){
+          intact &= pkt->data[3 + i] == probeByte(pkt->data[2], i);
+        }
+        probes += intact;
+        if(pkt->data[2] == probePackets - 1){
+          uint16_t errors = rx->crc_errors - trialErrors;
+          sendBaud(BAUD_REPORT, probes, errors > 0xFF ? 0xFF : errors);
+        }
+      }else if(op == BAUD_KEEP && to == step){
+        //answered every time, in case the server missed the last KEPT
+        if(baudState == BAUD_TRIAL){
+          baudState = BAUD_STEADY;
+          restartWindow();
+        }
+        target = step;
+        sendBaud(BAUD_KEPT);
+      }
+    }
+    //Resends the baud packet waiting on an answer, gives up on a trial
+    //that ran out of time and watches the CRC error rate
+    void pollBaud(){
+      uint32_t now = millis();
+      switch(baudState){
+        case BAUD_PROPOSED:
+          if(now - baudAt >= linkFirstTimeout) sendBaud(BAUD_PROPOSE, probed);
+          break;
+        case BAUD_PROBING:
+          if(now - trialAt >= trialServerTimeout){
+            revert();
+          }else if(probes < probePackets && now - baudAt >= probeGap){
+            sendProbe();
+          }
+          break;
+        case BAUD_KEEPING:
+          if(now - trialAt >= trialServerTimeout){
+            revert();
+          }else if(now - baudAt >= linkFirstTimeout){
+            sendBaud(BAUD_KEEP);
+          }
+          break;
+        case BAUD_TRIAL:
+          if(now - trialAt >= trialTimeout) revert();
+          break;
+        case BAUD_STEADY:
+          if((uint16_t)(rx->crc_errors - windowErrors) >= linkMaxErrors){
+            fallBack();
+          }else if(windowGood >= linkErrorWindow){
+            restartWindow();
+          }
+          break;
+      }
+    }
+    uint16_t getNonce(const uint8_t *p){
+      return p[0] | (p[1] << 8);
+    }
+    void send(uint8_t kind){
+      uint8_t payload[5] = {(uint8_t)clientNonce, (uint8_t)(clientNonce >> 8),
+        (uint8_t)serverNonce, (uint8_t)(serverNonce >> 8), snake};
+      packet_send(*port, kind, payload,
+          kind == PACKET_HELLO ? 2 : kind == PACKET_WELCOME ? 5 : 4);
+      if(kind != PACKET_READY){
+        attempts++;
+        sentAt = millis();
+      }
+    }
+    void up(){
+      state = LINK_UP;
+      connectMs = millis() - started;
+      restartWindow();
+      if(server && step + 1 < (int)linkSteps){
+        climbing = true;
+        propose(step + 1, true);
+      }
+    }
+  public:
+    uint16_t attempts; //HELLOs or WELCOMEs sent
+    uint16_t stale; //handshake packets ignored for a wrong nonce
+    uint32_t connectMs; //from begin until the session was up
+    uint8_t bestStep; //fastest step the link has run at
+    uint16_t trialsFailed; //rates tried that did not work
+    uint16_t fallbacks; //server: steps dropped for CRC errors in play
+    Link() : state(LINK_LISTEN), attempts(0), stale(0), connectMs(0),
+      bestStep(0), trialsFailed(0), fallbacks(0) {}
+    //Returns a fresh nonce, seeded by the time of the call
+    static uint16_t newNonce(){
+      uint32_t t = micros();
+      uint16_t nonce = t ^ (t >> 16);
+      return nonce ? nonce : 1;
+    }
+    //Starts a new session on p, which parser decodes, with this side's
+    //nonce; the server gives all of its links the same nonce and tells each
+    //client its snake
+    void begin(HardwareSerial &p, const packet_parser_t &parser, bool isServer,
+        uint16_t nonce, uint8_t client){
+      server = isServer;
+      port = &p;
+      rx = &parser;
+      snake = client;
+      baudState = BAUD_STEADY;
+      step = lastStep = target = 0;
+      climbing = false;
+      started = millis();
+      timeout = linkFirstTimeout;
+      clientNonce = serverNonce = 0;
+      if(server){
+        serverNonce = nonce;
+        state = LINK_LISTEN;
+      }else{
+        clientNonce = nonce;
+        state = LINK_HELLO;
+        send(PACKET_HELLO);
+      }
+    }
+    //Resends the last HELLO or WELCOME once its timeout runs out, and
+    //looks after the rate once the link is up
+    void poll(){
+      if(state == LINK_UP) pollBaud();
+      if(state != LINK_HELLO && state != LINK_WELCOME) return;
+      if(millis() - sentAt < timeout) return;
+      if(timeout < linkMaxTimeout) timeout *= 2;
+      send(state == LINK_HELLO ? PACKET_HELLO : PACKET_WELCOME);
+    }
+    //Takes any packet from the other arduino, acting on handshake and
+    //baud ones
+    void receive(const packet_t *pkt){
+      windowGood++;
+      switch(pkt->kind){
+        case PACKET_BAUD:
+          receiveBaud(pkt);
+          break;
+        case PACKET_HELLO:
+          if(!server || pkt->len != 2) return;
+          if(state != LINK_LISTEN && getNonce(pkt->data) != clientNonce){
+            if(state == LINK_UP){ //too late, this session is running
+              stale++;
+              return;
+            }
+            timeout = linkFirstTimeout; //client restarted, start over
+          }
+          if(state == LINK_LISTEN) timeout = linkFirstTimeout;
+          clientNonce = getNonce(pkt->data);
+          if(state != LINK_UP) state = LINK_WELCOME;
+          send(PACKET_WELCOME);
+          break;
+        case PACKET_WELCOME:
+          if(server || pkt->len != 5) return;
+          if(getNonce(pkt->data) != clientNonce){
+            stale++;
+            return;
+          }
+          //answered every time, in case the server missed the last READY
+          serverNonce = getNonce(pkt->data + 2);
+          snake = pkt->data[4];
+          send(PACKET_READY);
+          if(state != LINK_UP) up();
+          break;
+        case PACKET_READY:
+          if(!server || pkt->len != 4 || state != LINK_WELCOME) return;
+          if(getNonce(pkt->data) != clientNonce
+              || getNonce(pkt->data + 2) != serverNonce){
+            stale++;
+            return;
+          }
+          up();
+          break;
+        case PACKET_TICK:
+          //the client only ticks once it is up, so its READY was lost
+          if(server && state == LINK_WELCOME) up();
+          break;
+      }
+    }
+    //True once the link is up and, on the server, at its final rate
+    bool connected(){
+      return state == LINK_UP && !climbing;
+    }
+    //Returns the rate the link runs at
+    uint32_t baud(){
+      return linkRate(step);
+    }
+    //Both nonces together identify the session
+    uint32_t session(){
+      return ((uint32_t)clientNonce << 16) | serverNonce;
+    }
+    //The client's snake, known on a client once the link is up
+    uint8_t player(){
+      return snake;
+    }
+};
+
+//How far behind the receiving on one link got
+class RxStats{
+  public:
+    uint8_t backlogMax; //most bytes waiting in the receive ring at a drain
+    uint8_t packetsMax; //most packets taken in one drain
+    uint16_t full; //drains that found the ring full, so bytes were likely lost
+    RxStats() : backlogMax(0), packetsMax(0), full(0) {}
+};
+
+//Counts of the game state checks between the server and a client
+class SyncStats{
+  public:
+    uint16_t checks; //hashes compared
+    uint16_t mismatches; //hashes that differed
+    uint16_t resyncs; //server snapshots sent or taken
+    uint16_t maxTicks; //longest wait from a mismatch to the snapshot, in ticks
+    uint16_t retries; //snapshots cut short and asked for or sent again
+    SyncStats() : checks(0), mismatches(0), resyncs(0), maxTicks(0), retries(0) {}
+};
+
+// buckets in the head cell hash, a power of two at least twice maxSnakes
+#define headBucketBits 4
+#define headBuckets (1 << headBucketBits)
+
+//Which snake's head is on which cell, so a head-on collision is one hash
+//lookup per moving snake instead of a comparison with every other head.
+//Snakes hash by cell into buckets chained through next[].
+class HeadIndex{
+  private:
+    uint8_t first[headBuckets]; //snake index + 1 of a bucket's first entry
+    uint8_t next[SNAKES]; //snake index + 1 of the next in the bucket
+    uint16_t cell[SNAKES]; //cell each snake's head is indexed under
+    static uint16_t cellOf(uint8_t layer, uint8_t x, uint8_t y){
+      return ((uint16_t)layer * fieldHeight + y) * fieldWidth + x;
+    }
+    static uint8_t bucketOf(uint16_t c){
+      return (uint16_t)(c * 40503u) >> (16 - headBucketBits); //Fibonacci hash
+    }
+    void unlink(uint8_t i){
+      uint8_t *p = &first[bucketOf(cell[i])];
+      while(*p != i + 1) p = &next[*p - 1];
+      *p = next[i];
+    }
+  public:
+    void clear(){
+      memset(first, 0, sizeof(first));
+    }
+    //Indexes snake i under the cell (x,y) on layer, replacing its old entry
+    //if it has one
+    void move(uint8_t i, uint8_t layer, uint8_t x, uint8_t y, bool indexed){
+      if(indexed) unlink(i);
+      cell[i] = cellOf(layer, x, y);
+      uint8_t b = bucketOf(cell[i]);
+      next[i] = first[b];
+      first[b] = i + 1;
+    }
+    //Returns the index of another snake whose head is on snake i's cell,
+    //or -1 if there is none
+    int8_t other(uint8_t i){
+      for(uint8_t j = first[bucketOf(cell[i])]; j; j = next[j - 1]){
+        if(j - 1 != i && cell[j - 1] == cell[i]) return j - 1;
+      }
+      return -1;
+    }
+};
+
 //Receive changes in direction from the clients
 //Send to clients if stuff has to be drawn on their screen 
 //Changes in direction to snakes on clients screen
 
 class GameManager{
   private:
-    uint8_t numSnakes;
-    Snake* s[2];
-    JoystickListener* js;
+    uint32_t frames; //number of game ticks run
+    static const uint8_t numSnakes = SNAKES;
+    GameSnake s[SNAKES];
+    HeadIndex heads; //head cells, for head-on collisions
+    uint32_t aiState; //xorshift state for steering, the same on both boards
     Orientation dirFlag;
+    bool handled; //layer jump already taken for this button press
+    uint8_t presses; //joystick presses seen so far
+    uint16_t movesCoalesced; //turns and jumps merged into others or no-ops
+    uint16_t movesDropped; //turns and jumps a full move queue turned away
+
+    uint8_t mySnake; //the snake this arduino's joystick steers
+    uint8_t growCounter; //ticks until the snakes next grow
+    uint32_t nextSample; //next tick to send this arduino's input for
+
+    //lockstep input rings, one per player, indexed by tick % inputWindow
+    uint8_t inputs[numPlayers][inputWindow];
+    //next tick each player's input is expected for; a client gets them all
+    //at once from the server and counts them in inputFrame[0]
+    uint32_t inputFrame[numPlayers];
+    uint32_t relayed; //server: next tick to send the clients the inputs for
+    uint32_t tickedAt; //millis() of the last tick
+    //tick packets being sent again, one a millisecond so they never fill
+    //the receive ring: resendNext is the next to go, up to resendEnd
+    uint32_t resendNext;
+    uint32_t resendEnd;
+    uint32_t resentAt; //millis() the last one went
+
+    uint8_t events; //events to send the peer at the end of this tick
+    //the server has a link to each client, a client one to the server
+    uint8_t numLinks;
+    packet_parser_t rx[CLIENTS]; //packets coming in on each link
+    RxStats rxStats[CLIENTS];
+    Link links[CLIENTS];
+    Scheduler clock; //when game ticks are due
+
+    //game state checks; a client keeps its own hash and the server's for
+    //the last checkpoint and compares them once it has both
+    SyncStats sync;
+    uint32_t localHash;
+    uint32_t serverHash;
+    uint8_t localHashTick;
+    uint8_t serverHashTick;
+    bool haveLocalHash;
+    bool haveServerHash;
+    uint32_t mismatchFrame; //client: frames when its hash last differed
+    //server: the clients that asked for a snapshot, and the tick it is for
+    uint8_t resyncLinks;
+    uint32_t resyncAt;
+    uint32_t lastResync; //tick of the last snapshot
+    //server: the clients that have not said they took the last snapshot,
+    //sent at millis() snapshotAt
+    uint8_t unsyncedLinks;
+    uint32_t snapshotAt;
+    //client: a snapshot is coming in for tick resyncTick, ticks wait for
+    //it; its last part came at millis() stateAt
+    bool resyncing;
+    uint32_t resyncTick;
+    uint32_t stateAt;
+    //one snake's state, as it comes; lent to the replay as its ring, as a
+    //board that records or plays back never takes a snapshot
+    uint8_t stateBuf[GameSnake::maxEncoded];
+    uint8_t stateHave; //bytes of it in so far
+#ifdef HOST
+    uint32_t desyncTick; //SNEK_DESYNC: tick a client knocks its state off
+    uint8_t loseState; //SNEK_LOSE_STATE: snapshots the server cuts short
+#endif
+    //the last checkpoint's hash, held until every input before it is in
+    bool hashPending;
+    uint32_t hashTick;
+    uint32_t pendingHash;
+
+    //prediction: the state before tick predictFrom, the last one this
+    //board had every input for, and the pixels changed since
+    bool predicting;
+    bool mispredicted; //an input came in that a predicted tick lacked
+    uint32_t predictFrom;
+    uint8_t predictState[maxPredict ? SNAKES * GameSnake::maxEncoded : 1];
+    uint8_t predictGrowth;
+    uint8_t predictWait;
+    uint32_t predictAi;
+    BitLog predictLog;
+    //each tick a snake moves its head and tail once; +1 for maxPredict 0
+    BitChange predictChanges[2 * SNAKES * maxPredict + 1];
+    uint16_t grew; //bit tick % 16 is set if the snakes grew on that tick
+    uint32_t recorded; //ticks written to the replay
+    uint32_t predicted; //ticks run on a guess
+    uint16_t rollbacks;
+    uint32_t redrawn; //pixels a rollback drew again
+
+    bool replaying; //inputs come from a replay file, not the players
+    uint16_t diverged; //ticks where the replay and the game disagreed
+    const char *recordName; //replay file to record the game to, or NULL
   public:    
-    GameManager() : js (new JoystickListener(VERT,HOR,SEL,450)){
+    //Sets up a new game once the board is initialised
+    void begin(){
+      joystick_begin(VERT,HOR,SEL,450);
       tft.fillScreen(0);
+      GameSnake::occupied.clear();
       // initialize current direction of movement for each snake
       dirFlag = (isServer) ? VERTICAL : HORIZONTAL;
-      numSnakes = 2;
-      s[0] = new Snake(20,10,DOWN,0xFF00,30);
-      s[1] = new Snake(40,10,RIGHT,0x0FF0,30);
+      frames = 0;
+      handled = 0;
+      presses = 0;
+      movesCoalesced = movesDropped = 0;
+      mySnake = 0;
+      growCounter = 150;
+      nextSample = inputDelay;
+      haveLocalHash = haveServerHash = false;
+      resyncLinks = 0;
+      lastResync = 0;
+      unsyncedLinks = 0;
+      resyncing = false;
+      stateHave = 0;
+      hashPending = false;
+      predicting = mispredicted = false;
+      predictLog.begin(predictChanges,
+        sizeof(predictChanges) / sizeof(predictChanges[0]));
+      grew = 0;
+      recorded = predicted = redrawn = 0;
+      rollbacks = 0;
+#ifdef HOST
+      const char *desync = getenv("SNEK_DESYNC");
+      desyncTick = desync ? strtoul(desync, NULL, 10) : 0;
+      const char *lose = getenv("SNEK_LOSE_STATE");
+      loseState = lose ? atoi(lose) : 0;
+#endif
+      //nobody has input for the first inputDelay ticks
+      memset(inputs, 0, sizeof(inputs));
+      for(int p = 0; p < numPlayers; p++){
+        inputFrame[p] = inputDelay;
+      }
+      relayed = inputDelay;
+      tickedAt = resentAt = 0;
+      resendNext = resendEnd = 0;
+      events = 0;
+      replaying = false;
+      diverged = 0;
+      recordName = NULL;
+      numLinks = isServer ? CLIENTS : 1;
+      for(int l = 0; l < numLinks; l++){
+        packet_parser_init(&rx[l]);
+      }
+      s[0].begin(20,10,DOWN,pgm_read_word(&snakeColours[0]),30);
+      s[1].begin(40,10,RIGHT,pgm_read_word(&snakeColours[1]),30);
+      //the others start along the bottom heading up, alternating layers
+      for(int i = 2; i < numSnakes; i++){
+        s[i].begin(16 * (i - 1), fieldHeight - 10, UP,
+            pgm_read_word(&snakeColours[i]), 30);
+        if(i % 2) s[i].setLayer(1);
+      }
+      heads.clear();
+      for(int i = 0; i < numSnakes; i++){
+        heads.move(i, s[i].getLayer(), s[i].getX(), s[i].getY(), false);
+      }
+      aiState = 1;
     }
-    bool waitOnSerial( uint8_t nbytes, long timeout, HardwareSerial &s) {
-      unsigned long deadline = millis() + timeout; //wait limit
-      while (s.available()<nbytes && (timeout<0 || millis()<deadline)) {
-        delay(1); // to reduce business
+    //Takes the joystick's latest snapshot and packs any turn or layer
+    //jump into an input byte
+    uint8_t readJoystick(int mySnake){
+      PROFILE_SCOPE(PROFILE_JOYSTICK);
+      uint8_t in = 0;
+      joystick_state_t stick;
+      joystick_read(&stick);
+      //the first push across the snake's way since the last tick is its
+      //turn, pushes along it change nothing and any after it wait for the
+      //next ticks
+      uint8_t dir;
+      while(joystick_push(&dir)){
+        Orientation axis = (dir % 2) ? HORIZONTAL : VERTICAL;
+        if(axis == dirFlag){
+          movesCoalesced++;
+          continue;
+        }
+        dirFlag = axis;
+        in = inputTurn | dir;
+        break;
       }
-      return s.available()>=nbytes;
+      if(!in && (stick.dx || stick.dy)){
+        //a stick held across the snake's way turns it too
+        if(abs(stick.dx) > abs(stick.dy) && (dirFlag != HORIZONTAL)){
+          in = inputTurn | ((stick.dx > 0) ? RIGHT : LEFT);
+          dirFlag = HORIZONTAL;
+        }
+        else if(abs(stick.dy) > abs(stick.dx) && dirFlag != VERTICAL){
+          in = inputTurn | ((stick.dy > 0) ? DOWN : UP);
+          dirFlag = VERTICAL;
+        }
+      }
+      //jump layer for a press held now or one that came and went since
+      //the last tick, but only once while the button is held down
+      bool tapped = stick.presses != presses;
+      presses = stick.presses;
+      if((stick.button && !handled) || tapped){
+        in |= inputLayer;
+      }
+      handled = stick.button;
+      return in;
     }
-    // what's the previous direction that was pressed
-    void run(){
-      bool handled;
-      uint32_t time = millis();
-      int counter = 150;
-      char* lengthstr = (char*)malloc(4*sizeof(char));
-      
+    //Gives snake i this tick's input and lets it take what it can of the
+    //moves it has waiting; every live snake gets one each tick
+    void applyInput(int i, uint8_t in){
+      if(s[i].isDead()) return;
+      if(in & inputTurn){
+        countMove(s[i].queueTurn((Direction)(in & inputDir)));
+      }
+      if(in & inputLayer){
+        countMove(s[i].queueLayer());
+      }
+      s[i].takeMoves();
+    }
+    void countMove(MoveResult result){
+      if(result == MOVE_COALESCED) movesCoalesced++;
+      if(result == MOVE_DROPPED) movesDropped++;
+    }
+    //Returns true if snake i would die moving one step towards dir
+    bool blocked(int i, Direction dir){
+      uint8_t x = s[i].getX();
+      uint8_t y = s[i].getY();
+      switch(dir){
+        case LEFT: if(x == 0) return true; x--; break;
+        case RIGHT: if(x == fieldWidth - 1) return true; x++; break;
+        case UP: if(y == 0) return true; y--; break;
+        case DOWN: if(y == fieldHeight - 1) return true; y++; break;
+      }
+      return GameSnake::occupied.get(s[i].getLayer(), x, y);
+    }
+    uint32_t aiRandom(){
+      aiState ^= aiState << 13;
+      aiState ^= aiState >> 17;
+      aiState ^= aiState << 5;
+      return aiState;
+    }
+    //Input for a computer snake: carry on unless blocked, turning to a free
+    //side when it is, and now and then turn anyway. It only looks at game
+    //state and aiState, so both boards steer their copies the same way.
+    uint8_t steer(int i){
+      Direction dir = s[i].getDirection();
+      bool ahead = blocked(i, dir);
+      if(!ahead && aiRandom() % 32) return 0;
+      Direction left = (Direction)((dir + 3) % 4);
+      Direction right = (Direction)((dir + 1) % 4);
+      bool canLeft = !blocked(i, left);
+      bool canRight = !blocked(i, right);
+      if(canLeft && canRight){
+        return inputTurn | ((aiRandom() & 1) ? left : right);
+      }
+      if(canLeft) return inputTurn | left;
+      if(canRight) return inputTurn | right;
+      return 0;
+    }
+    //Tells the other arduino snake i died; in lockstep both boards see
+    //the same collisions so nothing needs to be sent
+    void sendKill(int i){
+      if(lockstep || i >= numPlayers) return;
+      events |= eventKill(i);
+    }
+    //Returns the serial port link l runs over
+    HardwareSerial &linkPort(int l){
+      return isServer ? *clientPorts[l] : Serial2;
+    }
+    //Decodes the next packet from link l, reading only as many bytes as it
+    //takes; returns false if no complete packet is in yet
+    bool receivePacket(int l, packet_t *pkt){
+      HardwareSerial &port = linkPort(l);
+      while(!packet_next(&rx[l], pkt)){
+        if(!port.available()) return false;
+        packet_feed(&rx[l], port.read());
+      }
+      return true;
+    }
+    //Server: stores a client's lockstep inputs for player p, which arrive
+    //in tick order, one per tick, each packet also repeating the input for
+    //the tick before it
+    void receiveInput(int p, const packet_t *pkt){
+      if(pkt->len != 3) return;
+      uint8_t tick = pkt->data[0];
+      if((int8_t)(tick - (uint8_t)inputFrame[p]) < 0) return; //resent
+      if(tick == (uint8_t)(inputFrame[p] + 1)){
+        //the packet for inputFrame[p] was lost, take it from this one
+        takeInput(p, inputFrame[p], pkt->data[2]);
+        inputFrame[p]++;
+      }
+      if(tick != (uint8_t)inputFrame[p]){
+        LOG(INPUT_SEQUENCE, inputFrame[p], p, 0);
+        return;
+      }
+      takeInput(p, inputFrame[p], pkt->data[1]);
+      inputFrame[p]++;
+    }
+    //Schedules this arduino's input for tick at and sends it on; the
+    //previous tick's input rides along so one lost packet is recovered
+    //from the next
+    void sendInput(uint32_t at, uint8_t in){
+      inputs[mySnake][at % inputWindow] = in;
+      if(isServer){
+        inputFrame[0] = at + 1;
+        return;
+      }
+      sendTick(at);
+    }
+    //Sends the packet for tick: a client's own input for it, or from the
+    //server every player's to every client
+    void sendTick(uint32_t tick){
+      if(!isServer){
+        uint8_t payload[3] = {(uint8_t)tick, inputs[mySnake][tick % inputWindow],
+          inputs[mySnake][(tick - 1) % inputWindow]};
+        packet_send(Serial2, PACKET_TICK, payload, sizeof(payload));
+        return;
+      }
+      uint8_t payload[1 + 2 * numPlayers];
+      payload[0] = (uint8_t)tick;
+      for(int p = 0; p < numPlayers; p++){
+        payload[1 + p] = inputs[p][tick % inputWindow];
+        payload[1 + numPlayers + p] = inputs[p][(tick - 1) % inputWindow];
+      }
+      for(int l = 0; l < numLinks; l++){
+        packet_send(linkPort(l), PACKET_TICK, payload, sizeof(payload));
+      }
+    }
+    //Starts sending the last resendTicks tick packets again, once the
+    //ones sent again before are all out and resendTimeout has passed; the
+    //ones that arrived before are ignored
+    void resendRecent(){
+      if(resendNext < resendEnd || millis() - resentAt < resendTimeout) return;
+      resendEnd = isServer ? relayed : nextSample;
+      resendNext = resendEnd > inputDelay + resendTicks
+        ? resendEnd - resendTicks : inputDelay;
+      resentAt = millis() - 1;
+    }
+    //Sends the next tick packet being sent again, if a millisecond has
+    //passed since the last
+    void resendNextTick(){
+      if(resendNext >= resendEnd || millis() == resentAt) return;
+      sendTick(resendNext++);
+      resentAt = millis();
+    }
+    //Server: sends the clients every player's input for each tick they
+    //are all in for, one packet per tick with the tick before it repeated;
+    //holds off at a snapshot's tick until the snapshot is out
+    void relayInputs(){
+      for(;;){
+        if(resyncLinks && relayed == resyncAt) return;
+        for(int p = 0; p < numPlayers; p++){
+          if(inputFrame[p] <= relayed) return;
+        }
+        sendTick(relayed);
+        relayed++;
+      }
+    }
+    //Client: stores every player's inputs for a tick as relayed by the
+    //server, recovering the tick before it if that packet was lost
+    void receiveRelay(const packet_t *pkt){
+      if(pkt->len != 1 + 2 * numPlayers) return;
+      uint8_t tick = pkt->data[0];
+      uint32_t &next = inputFrame[0];
+      if((int8_t)(tick - (uint8_t)next) < 0) return; //resent
+      if(tick == (uint8_t)(next + 1)){
+        for(int p = 0; p < numPlayers; p++){
+          takeInput(p, next, pkt->data[1 + numPlayers + p]);
+        }
+        next++;
+      }
+      if(tick != (uint8_t)next){
+        LOG(RELAY_SEQUENCE, next, 0, 0);
+        return;
+      }
+      for(int p = 0; p < numPlayers; p++){
+        takeInput(p, next, pkt->data[1 + p]);
+      }
+      next++;
+      for(int p = 1; p < numPlayers; p++){
+        inputFrame[p] = next;
+      }
+    }
+    //Returns a hash of everything that decides the game from here on
+    uint32_t stateHash(){
+      uint32_t h = 2166136261UL; //FNV-1a offset basis
+      for(int i = 0; i < numSnakes; i++){
+        h = s[i].hash(h);
+      }
+      h = hashByte(h, growCounter);
+      h = hashByte(h, wait);
+      for(uint8_t b = 0; b < 32; b += 8){
+        h = hashByte(h, aiState >> b);
+      }
+      return h;
+    }
+    //Client: asks for the server's state if the hashes for the last
+    //checkpoint are both in and differ
+    void compareHashes(){
+      if(!haveLocalHash || !haveServerHash || localHashTick != serverHashTick){
+        return;
+      }
+      haveServerHash = false;
+      sync.checks++;
+      if(localHash == serverHash) return;
+      sync.mismatches++;
+      mismatchFrame = frames;
+      LOG(RESYNC, frames, 0, 0);
+      packet_send(Serial2, PACKET_RESYNC, &localHashTick, 1);
+    }
+    //Takes h, the hash of the state before tick, once every input before
+    //tick is in; the server sends it to every client, a client keeps it
+    //to compare with the server's
+    void checkpoint(uint32_t tick, uint32_t h){
+      if(isServer){
+        uint8_t payload[5] = {(uint8_t)tick, (uint8_t)h, (uint8_t)(h >> 8),
+          (uint8_t)(h >> 16), (uint8_t)(h >> 24)};
+        for(int l = 0; l < numLinks; l++){
+          packet_send(linkPort(l), PACKET_HASH, payload, sizeof(payload));
+        }
+        return;
+      }
+      localHash = h;
+      localHashTick = tick;
+      haveLocalHash = true;
+      compareHashes();
+    }
+    //Client: takes the server's hash for a checkpoint
+    void receiveHash(const packet_t *pkt){
+      if(pkt->len != 5) return;
+      serverHashTick = pkt->data[0];
+      serverHash = pkt->data[1] | (uint32_t)pkt->data[2] << 8
+        | (uint32_t)pkt->data[3] << 16 | (uint32_t)pkt->data[4] << 24;
+      haveServerHash = true;
+      compareHashes();
+    }
+    //Server: client l's state differed at a checkpoint, so it gets a
+    //snapshot of the state before the first tick not yet relayed
+    void requestResync(int l, const packet_t *pkt){
+      if(pkt->len != 1) return;
+      //a checkpoint from before the last snapshot is already fixed
+      if((int8_t)(pkt->data[0] - (uint8_t)lastResync) < 0) return;
+      queueSnapshot(l);
+    }
+    //Server: client l gets a snapshot at the first tick not yet relayed
+    void queueSnapshot(int l){
+      //the snapshot has to be of a confirmed state, and the client may
+      //never send the inputs the guessed ticks are waiting on
+      if(predicting){
+        rollback(predictFrom);
+        predicting = false;
+        GameSnake::occupied.log = NULL;
+        if(hashPending && hashTick > frames) hashPending = false;
+      }
+      if(!resyncLinks) resyncAt = relayed;
+      resyncLinks |= 1 << l;
+    }
+    //Server: sends the clients that asked every snake's state and then the
+    //game's, once the server has reached the snapshot's tick
+    void sendSnapshot(){
+      uint8_t payload[PACKET_MAX_PAYLOAD];
+      uint8_t state[GameSnake::maxEncoded];
+      payload[0] = (uint8_t)frames;
+      for(int i = 0; i < numSnakes; i++){
+        uint8_t n = s[i].encode(state);
+        payload[1] = i;
+        for(uint8_t off = 0; off < n; off += stateChunk){
+          uint8_t len = min(stateChunk, n - off);
+          payload[2] = off;
+          memcpy(payload + 3, state + off, len);
+          sendState(payload, 3 + len);
+        }
+      }
+      payload[1] = stateCommit;
+      payload[2] = growCounter;
+      payload[3] = wait;
+      for(uint8_t b = 0; b < 4; b++){
+        payload[4 + b] = aiState >> (8 * b);
+      }
+      sendState(payload, 8);
+      lastResync = frames;
+      unsyncedLinks |= resyncLinks;
+      snapshotAt = millis();
+      resyncLinks = 0;
+      sync.resyncs++;
+      relayInputs();
+    }
+    //Server: client l took the snapshot for tick
+    void snapshotTaken(int l, const packet_t *pkt){
+      if(pkt->len == 1 && pkt->data[0] == (uint8_t)lastResync){
+        unsyncedLinks &= ~(1 << l);
+      }
+    }
+    //Server: sends the snapshot again to the clients that have not said
+    //they took it, at the first tick not yet relayed
+    void resendSnapshot(){
+      for(int l = 0; l < numLinks; l++){
+        if(unsyncedLinks & (1 << l)) queueSnapshot(l);
+      }
+      unsyncedLinks = 0;
+      sync.retries++;
+    }
+    void sendState(const uint8_t *payload, uint8_t len){
+#ifdef HOST
+      //the first snapshots lose the part that ends them, to try out the
+      //retries
+      if(loseState && payload[1] == stateCommit){
+        loseState--;
+        return;
+      }
+#endif
+      for(int l = 0; l < numLinks; l++){
+        if(resyncLinks & (1 << l)){
+          packet_send(linkPort(l), PACKET_STATE, payload, len);
+        }
+      }
+    }
+    //Client: takes part of a snapshot. Ticks wait until all of it is in;
+    //a snake with a part missing keeps its own state and the next
+    //checkpoint catches it
+    void receiveState(const packet_t *pkt){
+      if(pkt->len < 3) return;
+      //the server holds back the snapshot's tick, so only ticks this board
+      //ran on a guess can be past it
+      resyncTick = frames + (int8_t)(pkt->data[0] - (uint8_t)frames);
+      resyncing = true;
+      stateAt = millis();
+      uint8_t i = pkt->data[1];
+      uint8_t off = pkt->data[2];
+      uint8_t len = pkt->len - 3;
+      if(i == stateCommit){
+        if(pkt->len == 8) takeSnapshot(pkt->data + 2);
+        return;
+      }
+      if(i >= numSnakes || off + len > sizeof(stateBuf)) return;
+      if(!off) stateHave = 0;
+      if(off != stateHave) return; //lost the part before this one
+      memcpy(stateBuf + off, pkt->data + 3, len);
+      stateHave += len;
+      if(stateHave >= 7 && stateHave == GameSnake::encodedSize(stateBuf)){
+        s[i].decode(stateBuf);
+        stateHave = 0;
+      }
+    }
+    //Client: gives up on a snapshot a part of which was lost, and asks
+    //for another; ticks go on meanwhile, and any snake already taken
+    //from it makes the next checkpoint differ if the new one is lost too
+    void dropSnapshot(){
+      uint8_t tick = resyncTick;
+      stateHave = 0;
+      resyncing = false;
+      sync.retries++;
+      packet_send(Serial2, PACKET_RESYNC, &tick, 1);
+    }
+    //Client: finishes a snapshot, jumping to its tick and rebuilding the
+    //occupancy, head index and screen from the snakes, and tells the
+    //server it did
+    void takeSnapshot(const uint8_t *game){
+      growCounter = game[0];
+      wait = game[1];
+      aiState = game[2] | (uint32_t)game[3] << 8
+        | (uint32_t)game[4] << 16 | (uint32_t)game[5] << 24;
+      //a board running ahead can be past the snapshot's tick, so the wait
+      //is the ticks it ran on the bad state
+      uint32_t waited = frames - mismatchFrame;
+      if(waited > 0xFFFF) waited = 0xFFFF;
+      if(waited > sync.maxTicks) sync.maxTicks = waited;
+      frames = resyncTick;
+      recorded = frames;
+      resyncing = false;
+      uint8_t tick = resyncTick;
+      packet_send(Serial2, PACKET_STATE, &tick, 1);
+      predicting = mispredicted = hashPending = false;
+      GameSnake::occupied.log = NULL;
+      haveLocalHash = haveServerHash = false;
+      sync.resyncs++;
+      GameSnake::occupied.clear();
+      heads.clear();
+      tft.fillScreen(0);
+      for(int i = 0; i < numSnakes; i++){
+        s[i].claim(isServer ? 0 : 1);
+        heads.move(i, s[i].getLayer(), s[i].getX(), s[i].getY(), false);
+      }
+      screen.flush();
+    }
+    //Stores player p's input for tick; one that is late for a predicted
+    //tick, which ran without it, means the prediction was wrong
+    void takeInput(int p, uint32_t tick, uint8_t in){
+      inputs[p][tick % inputWindow] = in;
+      if(predicting && p != mySnake && tick < frames && in){
+        mispredicted = true;
+      }
+    }
+    //Returns the first tick player p's input is not in yet for; a board
+    //has its own player's as soon as it is scheduled
+    uint32_t knownUntil(int p){
+      return p == mySnake ? nextSample : inputFrame[p];
+    }
+    //Returns true if every input for the ticks before tick is in
+    bool allKnown(uint32_t tick){
+      if(replaying || !lockstep) return true;
+      for(int p = 0; p < numPlayers; p++){
+        if(knownUntil(p) < tick) return false;
+      }
+      return true;
+    }
+    //Fills in each player's input for tick, empty for the ones not in
+    void gatherInputs(uint32_t tick, uint8_t *in){
+      for(int p = 0; p < numPlayers; p++){
+        in[p] = tick < knownUntil(p) ? inputs[p][tick % inputWindow] : 0;
+      }
+    }
+    //Returns true if the next tick may run on a guess: prediction is on,
+    //this board is not too far ahead, the guessed game is not over and
+    //no snapshot is due
+    bool canPredict(){
+      if(!maxPredict || replaying || !lockstep || resyncLinks) return false;
+      if(predicting && frames - predictFrom >= maxPredict) return false;
+      return alivePlayers() > 1 || wait;
+    }
+    //Saves the state before this tick, the first to run on a guess, and
+    //starts noting the pixels the ticks from here change
+    void startPrediction(){
+      uint8_t *p = predictState;
+      for(int i = 0; i < numSnakes; i++){
+        p += s[i].encode(p);
+      }
+      predictGrowth = growCounter;
+      predictWait = wait;
+      predictAi = aiState;
+      predictFrom = frames;
+      predictLog.count = 0;
+      GameSnake::occupied.log = &predictLog;
+      predicting = true;
+    }
+    //Returns the colour (x,y) on layer should show: the first snake that
+    //covers it, or black
+    uint16_t ownerColour(uint8_t layer, uint8_t x, uint8_t y){
+      if(!GameSnake::occupied.get(layer, x, y)) return 0;
+      for(int i = 0; i < numSnakes; i++){
+        if(s[i].covers(layer, x, y)) return s[i].getColour();
+      }
+      return 0;
+    }
+    //Puts the game back to the state before predictFrom and runs the ticks
+    //from there to until again with the inputs now in, then draws just the
+    //pixels whose colour changed
+    void rollback(uint32_t until){
+      PROFILE_SCOPE(PROFILE_TICK);
+      uint8_t shownLayer = isServer ? 0 : 1;
+      //the pixels the guessed ticks drew, and the colour each has now
+      struct{ uint8_t x, y; uint16_t colour; } drawn[sizeof(predictChanges)
+        / sizeof(predictChanges[0])];
+      uint8_t numDrawn = 0;
+      for(uint8_t k = 0; k < predictLog.count; k++){
+        const BitChange &c = predictChanges[k];
+        if((c.layerWas & 1) != shownLayer) continue;
+        drawn[numDrawn].x = c.x;
+        drawn[numDrawn].y = c.y;
+        drawn[numDrawn].colour = ownerColour(shownLayer, c.x, c.y);
+        numDrawn++;
+      }
+      GameSnake::occupied.undo(predictLog);
+      const uint8_t *p = predictState;
+      heads.clear();
+      for(int i = 0; i < numSnakes; i++){
+        s[i].decode(p);
+        p += GameSnake::encodedSize(p);
+        heads.move(i, s[i].getLayer(), s[i].getX(), s[i].getY(), false);
+      }
+      growCounter = predictGrowth;
+      wait = predictWait;
+      aiState = predictAi;
+      screen.muted = true;
+      //the ticks run again end where the game does, which may be sooner
+      for(frames = predictFrom; frames < until && (alivePlayers() > 1 || wait);
+          frames++){
+        uint8_t in[numPlayers];
+        gatherInputs(frames, in);
+        simulate(frames, in);
+      }
+      screen.muted = false;
+      for(uint8_t k = 0; k < numDrawn; k++){
+        uint16_t colour = ownerColour(shownLayer, drawn[k].x, drawn[k].y);
+        if(colour != drawn[k].colour){
+          screen.plot(drawn[k].x, drawn[k].y, colour);
+          redrawn++;
+        }
+      }
+      //pixels only the ticks run again touched were drawn as they were
+      //before predictFrom, so they all changed
+      for(uint8_t k = 0; k < predictLog.count; k++){
+        const BitChange &c = predictChanges[k];
+        if((c.layerWas & 1) != shownLayer) continue;
+        bool seen = false;
+        for(uint8_t j = 0; j < numDrawn && !seen; j++){
+          seen = drawn[j].x == c.x && drawn[j].y == c.y;
+        }
+        if(!seen){
+          screen.plot(c.x, c.y, ownerColour(shownLayer, c.x, c.y));
+          redrawn++;
+        }
+      }
+      screen.flush();
+      mispredicted = false;
+      rollbacks++;
+    }
+    //Catches up with the inputs that came in: rolls back a wrong
+    //prediction, then hands on the checkpoint hash and records the ticks
+    //once every input for them is in, and ends the prediction once every
+    //tick run so far has them all
+    void confirm(){
+      if(mispredicted) rollback(frames);
+      if(hashPending && allKnown(hashTick)){
+        hashPending = false;
+        checkpoint(hashTick, pendingHash);
+      }
+      while(recorded < frames && allKnown(recorded + 1)){
+        uint8_t in[numPlayers];
+        gatherInputs(recorded, in);
+        replay_record_tick(recorded, in, numPlayers, grew >> (recorded % 16) & 1);
+        recorded++;
+      }
+      if(predicting && allKnown(frames)){
+        predicting = false;
+        GameSnake::occupied.log = NULL;
+      }
+    }
+    //Runs tick: every snake takes its input or steers itself, grows and
+    //moves, and the collisions are settled; returns true if the snakes grew
+    bool simulate(uint32_t tick, const uint8_t *in){
+      if(lockstep && !replaying && tick % hashInterval == 0){
+        hashPending = true;
+        hashTick = tick;
+        pendingHash = stateHash();
+      }
+      for(int i = 0; i < numPlayers; i++){
+        applyInput(i, in[i]);
+      }
+      if(wait){ //allows for arduinos to finalise win conditions
+        wait--;
+        for(int i = 0; i < numPlayers; i++){
+          if(s[i].isDead()) sendKill(i);
+        }
+      }
+      for(int i = numPlayers; i < numSnakes; i++){
+        if(!s[i].isDead()) applyInput(i, steer(i));
+      }
+      bool grow = !--growCounter; //decrement then check
+      if(grow){
+        for(int i = 0; i < numSnakes; i++){
+          s[i].pendingLength++;
+        }
+        growCounter = 15; //increment snakes' sizes 2 times / s
+      }
+      grew = (grew & ~(1U << (tick % 16))) | (uint16_t)grow << (tick % 16);
+      for(int i = 0; i < numSnakes; i++){
+        if(!s[i].isDead()){
+          {
+            PROFILE_SCOPE(PROFILE_UPDATE);
+            s[i].update(); //update snake position
+          }
+          PROFILE_SCOPE(PROFILE_COLLIDE);
+          heads.move(i, s[i].getLayer(), s[i].getX(), s[i].getY(), true);
+          int8_t j = heads.other(i);
+          if(j >= 0){
+            s[i].kill(); //check for head-on collision
+            s[j].kill();
+            sendKill(i);
+            sendKill(j);
+            continue;
+          }
+          if(s[i].hasCollided()){
+            s[i].kill(); //check for regular collisions
+            sendKill(i);
+          }
+        }
+      }
+      return grow;
+    }
+    //Returns true once every player's input for the next tick is in
+    bool inputsIn(){
+      for(int p = 0; p < numPlayers; p++){
+        if(inputFrame[p] <= frames) return false;
+      }
+      return true;
+    }
+    //Returns true once every link is up
+    bool connected(){
+      for(int l = 0; l < numLinks; l++){
+        if(!links[l].connected()) return false;
+      }
+      return true;
+    }
+    //Returns how many players are still alive
+    int alivePlayers(){
+      int alive = 0;
+      for(int p = 0; p < numPlayers; p++) alive += !s[p].isDead();
+      return alive;
+    }
+    //Applies an event byte from the other arduino straight away; only
+    //used without lockstep, so with a single client
+    void applyEvents(uint8_t in){
+      applyInput(isServer ? 1 : 0, in);
+      for(int i = 0; i < numSnakes; i++){
+        if(in & eventKill(i)){
+          s[i].kill();
+        }
+      }
+    }
+    //Notes how many bytes link l has waiting before a drain; the receive
+    //ring holds one less than its size, and once full it drops bytes
+    void noteBacklog(int l){
+      uint8_t waiting = linkPort(l).available();
+      RxStats &stats = rxStats[l];
+      if(waiting > stats.backlogMax) stats.backlogMax = waiting;
+      if(waiting >= SERIAL_RX_BUFFER_SIZE - 1) stats.full++;
+    }
+    void notePackets(int l, uint8_t packets){
+      if(packets > rxStats[l].packetsMax) rxStats[l].packetsMax = packets;
+    }
+    //Handles every packet waiting on every link
+    void receivePackets(){
+      PROFILE_SCOPE(PROFILE_SERIAL);
+      packet_t pkt;
+      for(int l = 0; l < numLinks; l++){
+        uint8_t packets = 0;
+        noteBacklog(l);
+        while(receivePacket(l, &pkt)){
+          if(packets < 0xFF) packets++;
+          links[l].receive(&pkt);
+          if(pkt.kind == PACKET_HASH && !isServer){
+            receiveHash(&pkt);
+          }else if(pkt.kind == PACKET_RESYNC && isServer){
+            requestResync(l, &pkt);
+          }else if(pkt.kind == PACKET_STATE){
+            if(isServer) snapshotTaken(l, &pkt);
+            else receiveState(&pkt);
+          }
+          if(pkt.kind != PACKET_TICK) continue;
+          if(!lockstep){
+            if(pkt.len == 2) applyEvents(pkt.data[1]);
+          }else if(isServer){
+            receiveInput(links[l].player(), &pkt);
+          }else{
+            receiveRelay(&pkt);
+          }
+        }
+        notePackets(l, packets);
+      }
+      if(lockstep && isServer) relayInputs();
+    }
+    //Polls every link's handshake
+    void pollLinks(){
+      for(int l = 0; l < numLinks; l++){
+        links[l].poll();
+      }
+    }
+    //Waits ms milliseconds, still answering the other arduinos and sending
+    //the last tick packets again for any that lost them
+    void pause(unsigned long ms){
+      unsigned long start = millis();
+      while(millis() - start < ms){
+        receivePackets();
+        pollLinks();
+        if(lockstep){
+          resendRecent();
+          resendNextTick();
+        }
+        log_drain(Serial);
+        delay(1);
+      }
+    }
+    //Returns the bytes sent to the display for snake movement so far
+    uint32_t getSpiBytes(){
+      return screen.sent;
+    }
+    //Returns the bytes drawing every head and tail update with its own
+    //drawPixel, as snakes used to, would have sent so far
+    uint32_t getUnbatchedSpiBytes(){
+      return (screen.plotted + screen.skipped) * (spiWindowBytes + spiPixelBytes);
+    }
+    //Returns the number of game ticks run so far
+    uint32_t getFrames(){
+      return frames;
+    }
+    //Returns how many links this arduino has
+    int getLinks(){
+      return numLinks;
+    }
+    //Returns link l, for its stats
+    Link &getLink(int l){
+      return links[l];
+    }
+    //Returns link l's packet parser, for its error counts
+    const packet_parser_t &getParser(int l){
+      return rx[l];
+    }
+    //Returns how far behind link l's receiving got
+    RxStats &getRxStats(int l){
+      return rxStats[l];
+    }
+    //Returns the game tick schedule, for its frame period stats
+    Scheduler &getClock(){
+      return clock;
+    }
+    //Returns how many snakes, players or not, have died
+    int getDeadSnakes(){
+      int dead = 0;
+      for(int i = 0; i < numSnakes; i++) dead += s[i].isDead();
+      return dead;
+    }
+    //Plays the game back from a replay file instead of taking input from
+    //the joystick and the other arduinos; returns false if the file
+    //cannot be played
+    bool playBack(const char *name){
+      replay_header_t hdr;
+      if(!replay_play_begin(name, &hdr, stateBuf, sizeof(stateBuf))){
+        return false;
+      }
+      if(hdr.players != numPlayers || hdr.snakes != numSnakes){
+        LOG(REPLAY_SNAKES, 0, 0, 0);
+        replay_play_end();
+        return false;
+      }
+      aiState = hdr.seed;
+      replaying = true;
+      return true;
+    }
+    //Records the game to a replay file once it starts
+    void record(const char *name){
+      recordName = name;
+    }
+    //Returns true if the game is played back from a replay
+    bool isReplaying(){
+      return replaying;
+    }
+    //Returns the game state check counts, for their stats
+    SyncStats &getSync(){
+      return sync;
+    }
+    //Returns the turns and jumps merged away or turned away by a full
+    //move queue
+    uint16_t getMovesCoalesced(){
+      return movesCoalesced;
+    }
+    uint16_t getMovesDropped(){
+      return movesDropped;
+    }
+    //Returns the ticks run on a guess, the guesses that were wrong and the
+    //pixels drawn again putting them right
+    uint32_t getPredicted(){
+      return predicted;
+    }
+    uint16_t getRollbacks(){
+      return rollbacks;
+    }
+    uint32_t getRedrawn(){
+      return redrawn;
+    }
+    //Returns the ticks where a replay and the game it drove disagreed
+    uint16_t getDiverged(){
+      return diverged;
+    }
+    //Shows the title screens, connects to the other arduinos and counts
+    //down to the start of the game
+    void start(){
       //solely for aesthetics
-      typedef enum{listen, start, ack, data} phase;
-      phase currPhase;
-      Serial.println("I am here");
+      LOG(HELLO, 0, 0, 0);
       tft.setCursor(0,0);
       tft.setTextColor(0xBBBB,0x0000);
-      tft.print("  | \n  | \n  | \n  | \n  | \n  `-------||SNAKE||>");
+      tft.print(F("  | \n  | \n  | \n  | \n  | \n  `-------||SNAKE||>"));
       
       delay(1000);
       tft.setCursor(0,0);
       tft.setTextColor(0xAAAA,0x0000);
-      tft.print("|\n|\n|\n|\n|\n|\n|\n`--------------|2p>");
-      
-      delay(500);
-      tft.setCursor(0,88);
-      tft.setTextColor(isServer ? 0xFF00 : 0x0FF0,0x0000);
-      tft.print(isServer ? "This arduino controlsthe blue snake!"
-                          : "This arduino controlsthe green snake!");
+      tft.print(F("|\n|\n|\n|\n|\n|\n|\n`--------------|"));
+      tft.print((char)('0' + numPlayers));
+      tft.print(F("p>"));
       
-      delay(1500);
+      delay(2000);
       tft.setCursor(20,66);
       tft.setTextColor(0xFFFF,0x0000);
-      tft.print("Click when ready");
+      tft.print(F("Click when ready"));
 
-      while(!js->isDepressed())delay(1); //wait for user input
+      joystick_state_t stick;
+      do{ //wait for user input
+        log_drain(Serial);
+        delay(1);
+        joystick_read(&stick);
+      }while(!stick.button);
+      presses = stick.presses; //only the button still held counts
+      joystick_clear_pushes(); //and only the stick's way from here on
       tft.setCursor(20,66);
       tft.setTextColor(0xFFFF,0x0000);
-      tft.print("Connecting......");
+      tft.print(F("Connecting......"));
       
-      // init serial communication with server or client
-      // handshake to ensure communication is happening before main loop 
-      if(!isServer) {
-        currPhase = start;
-        while(currPhase != data) {
-          switch(currPhase){
-            case start:
-              Serial.println("Client request sent");
-              Serial2.write('C');
-              currPhase = ack;
-            case ack:
-              Serial.println("Waiting for acknowledgement ... ");
-              if(waitOnSerial(1, 1000, Serial2)){
-                char A = Serial2.read();
-                if(A != 'A'){
-                  Serial.println("No acknowledgement recieved");
-                  currPhase = start;
-                  break;
-                }
-                Serial.println("Got acknowledgement");
-                Serial2.write('A');
-                currPhase = data;
-              }
-              else{
-                Serial.println("Timeout");
-                currPhase = start;
-              }
-              break;
-          }
-        }
+      // handshake to ensure communication is happening before main loop
+      uint16_t nonce = Link::newNonce();
+      for(int l = 0; l < numLinks; l++){
+        links[l].begin(linkPort(l), rx[l], isServer, nonce, l + 1);
       }
-      else {
-        currPhase = listen;
-        while(currPhase != data){
-          switch(currPhase){
-            case listen:
-              if(waitOnSerial(1, 1000, Serial2)){
-                char C = Serial2.read();
-                if(C == 'C') {
-                  currPhase = ack;
-                  Serial2.write('A');
-                }
-              }
-              else{
-                Serial.println("Timeout");
-              }
-            case ack:
-              Serial.println("Waiting for acknowledgement ... ");
-              if(waitOnSerial(1, 1000, Serial2)){
-                char A = Serial2.read();
-                if(A == 'A'){
-                  Serial.println("Got Acknowledgement");
-                  currPhase = data;
-                }
-              }
-              else {
-                Serial.println("Timeout");
-                currPhase = listen;
-              }
-          }
-        }
+      while(!connected()){
+        receivePackets();
+        pollLinks();
+        log_drain(Serial);
+        delay(1);
+      }
+      for(int l = 0; l < numLinks; l++){
+        LOG(CONNECTED, links[l].connectMs, links[l].attempts,
+            links[l].session());
       }
+      //the server's nonce is in every session, so every board knows it
+      aiState = (uint16_t)links[0].session() | 1;
+      mySnake = isServer ? 0 : links[0].player();
+      dirFlag = (s[mySnake].getDirection() % 2) ? HORIZONTAL : VERTICAL;
+      //a client only learns which snake is its own once it is connected
+      tft.setCursor(0,88);
+      tft.setTextColor(pgm_read_word(&snakeColours[mySnake]),0x0000);
+      tft.print(F("This arduino controlsthe "));
+      tft.print((const __FlashStringHelper *)playerNames[mySnake]);
+      tft.print(F(" snake!"));
+      pause(1500);
       //more aesthetics
       tft.fillScreen(isServer ? 0xFFFF : 0x00FF);
       tft.setCursor(10,66);
       tft.setTextColor(0x0000);
-      //ensure that both players are looking at the starting layer
-      tft.print(isServer ? "READY?..." : "OTHER SCREEN");
+      //ensure that every player is looking at the layer their snake starts
+      //on: the server shows layer 0 and the clients layer 1
+      tft.print(s[mySnake].getLayer() == (isServer ? 0 : 1)
+          ? F("READY?...") : F("OTHER SCREEN"));
       tft.setTextColor(0xFFFF,0x00FF);
       
       //countdown
       tft.setCursor(60,88);
-      tft.print("[ 3 ]");
-      delay(1000);
+      tft.print(F("[ 3 ]"));
+      pause(1000);
       tft.setCursor(60,88);
-      tft.print("[ 2 ]");
-      delay(1000);
+      tft.print(F("[ 2 ]"));
+      pause(1000);
       tft.setCursor(60,88);
-      tft.print("[ 1 ]");
-      delay(1000);
+      tft.print(F("[ 1 ]"));
+      pause(1000);
+    }
+    // what's the previous direction that was pressed
+    void run(){
+      if(replaying){
+        LOG(REPLAYING, 0, 0, 0);
+      }else{
+        start();
+      }
+      if(recordName && !replaying
+          && !replay_record_begin(recordName, numPlayers, numSnakes, aiState,
+                                  stateBuf, sizeof(stateBuf))){
+        LOG(NO_RECORD, 0, 0, 0);
+      }
       
       tft.fillScreen(0);
-      Serial.println("Beginning main snake loop");
-      while((!s[0]->isDead() && !s[1]->isDead()) || wait){
-        if(millis() - time > 1000/fps){ //only run in the framerate
-          if(wait){ //allows for arduinos to finalise win conditions
-            wait--;
-            if(s[0]->isDead()){
-              Serial2.write('K');
-              Serial2.write('0');
-              Serial2.write('0');
-            }if(s[1]->isDead()){
-              Serial2.write('K');
-              Serial2.write('1');
-              Serial2.write('1');
-            }
+      LOG(MAIN_LOOP, 0, 0, 0);
+      mem_paint(); //stack watermarks for the game loop on its own
+      clock.begin();
+      tickedAt = resentAt = millis();
+      resendNext = resendEnd = 0;
+      //a predicted end only counts once every input for it is in
+      while(alivePlayers() > 1 || wait || predicting){
+        bool due = clock.due(); //only run in the framerate
+        if(lockstep && !replaying){
+          receivePackets();
+          pollLinks();
+          if(!resyncing) confirm();
+#ifdef HOST
+          //knock this client's state off to try out the resync
+          if(!isServer && desyncTick && frames >= desyncTick && !predicting){
+            s[0].pendingLength++;
+            desyncTick = 0;
           }
-          int mySnake = isServer ? 0 : 1;
-          char myName = isServer ? '0' : '1';
-          time = millis();
-          if(!--counter){ //decrement then check
-            s[0]->pendingLength++;
-            s[1]->pendingLength++;
-            counter = 15; //increment snakes' sizes 2 times / s
+#endif
+          //a tick that does not come is likely waiting on a lost packet
+          if(!resyncing && millis() - tickedAt >= resendTimeout){
+            resendRecent();
           }
-          for(int i = 0; i < numSnakes; i++){
-            if(!s[i]->isDead()){
-              s[i]->update(); //update snake position
-              uint8_t tmpX = s[i]->getX();
-              uint8_t tmpY = s[i]->getY();
-              uint8_t tmpLayer = s[i]->getLayer();
-              Direction tmpDir = s[i]->getDirection();
-              if(s[0]->getLayer() == s[1]->getLayer()
-                  && s[0]->getX() == s[1]->getX() && s[0]->getY() == s[1]->getY()){
-                s[0]->kill(); //check for head-on collision
-                s[1]->kill();
-                Serial2.write('K');
-                Serial2.write('0');
-                Serial2.write('0');
-                Serial2.write('K');
-                Serial2.write('1');
-                Serial2.write('1');
-                break;
-              }
-              for(int j = 0; j < numSnakes; j++){
-                if(s[j]->willCollide(tmpX, tmpY, tmpDir, tmpLayer)){
-                  s[i]->kill(); //check for regular collisions
-                  Serial2.write('K');
-                  Serial2.write(i ? '1' : '0');
-                  Serial2.write(i ? '1' : '0');
-                  break;
-                }
-              }
+          resendNextTick();
+          //this tick's input is scheduled inputDelay ticks ahead
+          uint32_t at = frames + inputDelay;
+          if(due && at >= nextSample){
+            uint8_t in = readJoystick(mySnake);
+            PROFILE_SCOPE(PROFILE_SERIAL);
+            //a snapshot can move a client ahead, the ticks it skipped
+            //still need an input each so they get an empty one
+            for(; nextSample <= at; nextSample++){
+              sendInput(nextSample, nextSample == at ? in : 0);
             }
+            if(isServer) relayInputs();
           }
-          if(js->isPushed() && !s[mySnake]->queueFull()){
-            //allow user to move snake
-            int deltaH = js->getHorizontal() - js->getHorizontalBaseline();
-            int deltaV = js->getVertical() - js->getVerticalBaseline();
-            if(abs(deltaH) > abs(deltaV) && (dirFlag != HORIZONTAL)){
-              s[mySnake]->setDirection((deltaH > 0) ? RIGHT : LEFT);
-              Serial2.write('D');
-              Serial2.write(myName);
-              Serial2.write((deltaH > 0) ? 'R' : 'L');
-              dirFlag = HORIZONTAL;
-              //s[0]->debug("On horizontal");
-            }
-            else if(abs(deltaV) > abs(deltaH) && dirFlag != VERTICAL){
-              s[mySnake]->setDirection((deltaV > 0) ? DOWN : UP);
-              Serial2.write('D');
-              Serial2.write(myName);
-              Serial2.write((deltaV > 0) ? 'D' : 'U');
-              dirFlag = VERTICAL;
-              //s[0]->debug("On vertical");
-            }
+          if(resyncLinks && frames == resyncAt && !predicting){
+            PROFILE_SCOPE(PROFILE_SERIAL);
+            sendSnapshot();
           }
-          if(js->isDepressed()){ //jump layer
-            if(!handled){ //ensure the joystick isn't being held down
-              int currLayer = s[mySnake]->getLayer();
-              s[mySnake]->setLayer(currLayer ? 0 : 1);
-              Serial2.write('L');
-              Serial2.write(myName);
-              Serial2.write(currLayer ? '0' : '1');
-              handled = 1;
-            }
-          }else{
-            handled = 0;
+          //a snapshot with a part lost would hold the client's ticks, and
+          //the server's behind them, for good
+          if(resyncing && millis() - stateAt >= resendTimeout){
+            dropSnapshot();
+          }
+          if(unsyncedLinks && millis() - snapshotAt >= snapshotTimeout){
+            resendSnapshot();
           }
-          if(Serial2.available() >= 3){ //read incoming bytes
-            char id = Serial2.read();
-            char snakeName = Serial2.read();
-            char in = Serial2.read();
-
-            Serial.println(id);
-            Serial.println(snakeName);
-            Serial.println(in);
-
-            switch(snakeName){
-              case '0':
-                snakeName = 0;
-                break;
-              case '1':
-                snakeName = 1;
-                break;
+        }
+        //in lockstep the tick waits until every input for it is in, or
+        //runs on a guess for the ones that are not; a guessed end only
+        //waits for the inputs that confirm it
+        bool playing = alivePlayers() > 1 || wait;
+        if(due && playing && !resyncing && !(resyncLinks && frames == resyncAt)
+            && (replaying || !lockstep || inputsIn() || canPredict())){
+          profile_frame();
+          PROFILE_SCOPE(PROFILE_TICK);
+          uint32_t tick = frames;
+          uint8_t in[numPlayers]; //each player's input for this tick
+          uint8_t played = 0; //the replay's flags for this tick
+          memset(in, 0, sizeof(in));
+          if(replaying){
+            played = replay_play_tick(tick, in, numPlayers);
+            if(played & REPLAY_END) diverged++; //the game should be over
+          }else if(lockstep){
+            if(!predicting && !inputsIn()){
+              startPrediction();
             }
-            //parse and interpret
-            if(!s[snakeName]->isDead()){
-              if(id == 'D'){
-                switch(in){
-                  case 'L':
-                    s[snakeName]->setDirection(LEFT);
-                    break;
-                  case 'R':
-                    s[snakeName]->setDirection(RIGHT);
-                    break;
-                  case 'U':
-                    s[snakeName]->setDirection(UP);
-                    break;
-                  case 'D':
-                    s[snakeName]->setDirection(DOWN);
-                    break;
-                }
-              }
-              else if(id == 'L'){
-                switch(in){
-                  case '0':
-                    s[snakeName]->setLayer(0);
-                    break;
-                  case '1':
-                    s[snakeName]->setLayer(1);
-                }
-              }
-              else if(id == 'K'){
-                s[snakeName]->kill();
-              }
+            if(predicting) predicted++;
+            gatherInputs(tick, in);
+          }
+          bool grow = simulate(tick, in);
+          clock.tick();
+          tickedAt = millis();
+          frames++;
+          if(replaying && grow != !!(played & REPLAY_GROW)) diverged++;
+          if(!lockstep || replaying) replay_record_tick(tick, in, numPlayers, grow);
+          if(lockstep && !replaying) confirm();
+          if(!lockstep){
+            //apply local input straight away and tell the other arduino
+            uint8_t in = readJoystick(mySnake);
+            applyInput(mySnake, in);
+            events |= in;
+            if(events){ //everything for this tick goes out in one packet
+              uint8_t payload[2] = {(uint8_t)frames, events};
+              PROFILE_SCOPE(PROFILE_SERIAL);
+              packet_send(Serial2, PACKET_TICK, payload, sizeof(payload));
+              events = 0;
             }
+            receivePackets();
           }
+          PROFILE_SCOPE(PROFILE_DRAW);
+          screen.flush(); //draw this tick's pixels in one go
         }
+        else{
+          replay_idle(); //spare time, write the replay out and the log
+          log_drain(Serial);
+          delay(1); //idle until the next frame is due
+        }
+      }
+      log_flush(Serial); //the stats come after everything logged
+      if(replaying){
+        //the game has to end on the tick the recorded one did
+        uint8_t in[numPlayers];
+        if(!(replay_play_tick(frames, in, numPlayers) & REPLAY_END)) diverged++;
+        replay_play_end();
+        Serial.print(F("Replay diverged on "));
+        Serial.print((unsigned int)diverged);
+        Serial.println(F(" ticks"));
+      }else{
+        replay_record_end(frames);
+      }
+      Serial.print(F("State checks: "));
+      Serial.print(sync.checks);
+      Serial.print(F(", mismatches: "));
+      Serial.print(sync.mismatches);
+      Serial.print(F(", resyncs: "));
+      Serial.print(sync.resyncs);
+      Serial.print(F(", retried: "));
+      Serial.println(sync.retries);
+      joystick_state_t stick;
+      joystick_read(&stick);
+      Serial.print(F("Moves coalesced: "));
+      Serial.print(movesCoalesced);
+      Serial.print(F(", dropped: "));
+      Serial.print(movesDropped);
+      Serial.print(F(", stick pushes lost: "));
+      Serial.println(stick.lost);
+      Serial.print(F("Predicted ticks: "));
+      Serial.print(predicted);
+      Serial.print(F(", rollbacks: "));
+      Serial.print(rollbacks);
+      Serial.print(F(", pixels redrawn: "));
+      Serial.println(redrawn);
+      for(int l = 0; l < numLinks; l++){
+        Serial.print(F("Link "));
+        Serial.print(l);
+        Serial.print(F(": "));
+        Serial.print(links[l].baud());
+        Serial.print(F(" baud, best "));
+        Serial.print(linkRate(links[l].bestStep));
+        Serial.print(F(", rates failed: "));
+        Serial.print(links[l].trialsFailed);
+        Serial.print(F(", fallbacks: "));
+        Serial.print(links[l].fallbacks);
+        Serial.print(F(", CRC errors: "));
+        Serial.print(rx[l].crc_errors);
+        Serial.print(F(", bytes dropped: "));
+        Serial.println(rx[l].dropped);
+        Serial.print(F("Link "));
+        Serial.print(l);
+        Serial.print(F(" receive backlog max: "));
+        Serial.print(rxStats[l].backlogMax);
+        Serial.print(F(" bytes, packets per drain max: "));
+        Serial.print(rxStats[l].packetsMax);
+        Serial.print(F(", ring full: "));
+        Serial.println(rxStats[l].full);
       }
       
       //game-ending aesthetics, once at least one snake dies
@@ -637,49 +2703,287 @@ class GameManager{
       tft.fillScreen(0xFFFF);
       tft.setCursor(10,66);
       tft.setTextColor(0x00FF,0xFFFF);
-      tft.print("---::GAME OVER::---");
+      tft.print(F("---::GAME OVER::---"));
       
-      delay(1000);
+      pause(1000); //the others may still need this board's last ticks
       tft.fillScreen(0x00FF);
       tft.fillScreen(0);
       delay(500);
       tft.setCursor(0,66);
       tft.setTextColor(0xFFFF,0x00FF);
       //identify the winner, if applicable
-      if(s[0]->isDead()){
-        if(s[1]->isDead()){
-          tft.print("  Dead: BOTH\n\n");
-          tft.setTextColor(0xBBBB,0x0000);
-          tft.print("  TIE GAME\n");
-        }else{
-          tft.print("  Dead: BLUE\n\n");
-          tft.setTextColor(0x0FF0,0x0000);
-          tft.print("  GREEN SNAKE WINS\n");
-          delay(500);
-          tft.setCursor(0,0);
-          if(!isServer)tft.print("|\n|\n|\n|\n|\n|\n|\n|\n|\n|\n|\n|\n`-|Congratulations||>");
-        }
+      int winner = -1;
+      for(int i = 0; i < numPlayers; i++){
+        if(!s[i].isDead()) winner = i;
+      }
+      if(winner < 0){
+        tft.print(numPlayers == 2 ? F("  Dead: BOTH\n\n") : F("  Dead: ALL\n\n"));
+        tft.setTextColor(0xBBBB,0x0000);
+        tft.print(F("  TIE GAME\n"));
       }else{
-        tft.print("  Dead: GREEN\n\n");
-        tft.setTextColor(0xFF00,0x0000);
-        tft.print("  BLUE SNAKE WINS\n");
+        tft.print(F("  Dead: "));
+        tft.print(numPlayers == 2 ? (const __FlashStringHelper *)playerNames[!winner]
+                                  : F("THE REST"));
+        tft.print(F("\n\n"));
+        tft.setTextColor(pgm_read_word(&snakeColours[winner]),0x0000);
+        tft.print(F("  "));
+        tft.print((const __FlashStringHelper *)playerNames[winner]);
+        tft.print(F(" SNAKE WINS\n"));
         delay(500);
         tft.setCursor(0,0);
-        if(isServer)tft.print("|\n|\n|\n|\n|\n|\n|\n|\n|\n|\n|\n|\n`-|Congratulations||>");
+        if(winner == mySnake){
+          tft.print(F("|\n|\n|\n|\n|\n|\n|\n|\n|\n|\n|\n|\n"
+                "`-|Congratulations||>"));
+        }
       }
       
     }
 };
+
+// the game lives in static storage, so its layout is fixed at link time and
+// nothing is ever allocated on the heap; begin() sets it up once the board is
+GameManager game;
+
+#ifdef HOST
+//Host only: true if (x,y) on layer starts one of the snake's segments
+//without update() having claimed it: the tail's pixel, which the tail has
+//already left, and a jump's first pixel on the layer it jumped to
+static bool unclaimedStart(GameSnake &snake, uint8_t layer, uint8_t x, uint8_t y){
+  uint8_t prev = snake.tail;
+  for(uint8_t i = snake.tail; ;
+      prev = i, GameSnake::incrSafe(i, 1, GameSnake::capacity)){
+    const snakeSeg &seg = snake.lineSegments[i];
+    if(seg.layer == layer && seg.x1 == x && seg.y1 == y
+        && (i == snake.tail || snake.lineSegments[prev].layer != layer)){
+      return true;
+    }
+    if(i == snake.head) break;
+  }
+  return false;
+}
+
+//Host only: times willCollide's walk of every segment against the index
+//on long, twisty snakes, and checks the two agree on every pixel with each
+//other, covers() with the occupancy, and the occupancy with the walk.
+//Each round's snake staircases down the field in legs of random length,
+//across and back, so it never meets itself, now and then jumping layer,
+//between turns or together with one, and every few ticks each pixel of
+//both layers is queried from every direction
+void benchSegments(int rounds){
+  static GameSnake snake;
+  uint32_t rng = 12345;
+  uint32_t walked = 0, indexed = 0, covered = 0; //us
+  uint32_t queries = 0, checks = 0, segments = 0, mismatches = 0, hits = 0;
+  uint32_t jumpTurns = 0, collideMismatches = 0;
+  screen.muted = true;
+  for(int r = 0; r < rounds; r++){
+    GameSnake::occupied.clear();
+    rng = rng * 1103515245 + 12345;
+    Direction across = (r & 1) ? LEFT : RIGHT;
+    snake.begin(across == RIGHT ? 2 : fieldWidth - 3, 1, across, 0xFFFF, 120);
+    uint8_t leg = 4;
+    bool turnBack = false;
+    for(uint16_t t = 1; !snake.isDead(); t++){
+      Direction dir = snake.plannedDirection();
+      uint8_t x = snake.getX();
+      bool level = dir % 2;
+      bool wall = level && (dir == RIGHT ? x >= fieldWidth - 3 : x <= 2);
+      if(!level && snake.getY() >= fieldHeight - 4) break;
+      if((leg == 0 || wall) && !snake.queueFull()){
+        //some turns come with a jump, given just before or after the turn
+        //in the same tick the way a player can
+        rng = rng * 1103515245 + 12345;
+        uint8_t jump = (rng >> 24) % 6;
+        if(jump == 0) snake.queueLayer();
+        if(level){
+          snake.queueTurn(DOWN);
+          turnBack = wall;
+        }else{
+          if(turnBack) across = across == RIGHT ? LEFT : RIGHT;
+          turnBack = false;
+          snake.queueTurn(across);
+        }
+        if(jump == 1) snake.queueLayer();
+        if(jump < 2) jumpTurns++;
+        leg = 2 + (rng >> 16) % 8;
+      }else if(wall){
+        break; //no room in the ring to turn
+      }else if(leg == 1 && (rng >> 24) % 4 == 0){
+        snake.queueLayer();
+      }
+      if(leg) leg--;
+      snake.takeMoves();
+      snake.update();
+      if(snake.hasCollided()) mismatches++; //the path crossed itself
+      if(t % 16) continue;
+
+      checks++;
+      segments += snake.getLength();
+      uint32_t start = micros();
+      for(uint8_t layer = 0; layer < 2; layer++){
+        for(uint8_t y = 0; y < fieldHeight; y++){
+          for(uint8_t x = 0; x < fieldWidth; x++){
+            for(uint8_t d = 0; d < 4; d++){
+              hits += snake.willCollide(x, y, (Direction)d, layer);
+            }
+          }
+        }
+      }
+      walked += micros() - start;
+      start = micros();
+      for(uint8_t layer = 0; layer < 2; layer++){
+        for(uint8_t y = 0; y < fieldHeight; y++){
+          for(uint8_t x = 0; x < fieldWidth; x++){
+            for(uint8_t d = 0; d < 4; d++){
+              hits -= snake.willCollideIndexed(x, y, (Direction)d, layer);
+            }
+          }
+        }
+      }
+      indexed += micros() - start;
+      start = micros();
+      for(uint8_t layer = 0; layer < 2; layer++){
+        for(uint8_t y = 0; y < fieldHeight; y++){
+          for(uint8_t x = 0; x < fieldWidth; x++){
+            hits += snake.covers(layer, x, y);
+          }
+        }
+      }
+      covered += micros() - start;
+      queries += 2 * fieldHeight * fieldWidth;
+      for(uint8_t layer = 0; layer < 2; layer++){
+        for(uint8_t y = 0; y < fieldHeight; y++){
+          for(uint8_t x = 0; x < fieldWidth; x++){
+            for(uint8_t d = 0; d < 4; d++){
+              mismatches += snake.willCollide(x, y, (Direction)d, layer)
+                != snake.willCollideIndexed(x, y, (Direction)d, layer);
+            }
+            mismatches += snake.covers(layer, x, y)
+              != GameSnake::occupied.get(layer, x, y);
+            //and the board's walk in place of the index
+            mismatches += snake.covers(layer, x, y)
+              != snake.coversWalk(layer, x, y);
+            //the collision bit against the walk it replaced: queried from
+            //every direction, willCollide reaches each segment end to end
+            bool walk = false;
+            for(uint8_t d = 0; d < 4; d++){
+              walk |= snake.willCollide(x, y, (Direction)d, layer);
+            }
+            collideMismatches += walk != (GameSnake::occupied.get(layer, x, y)
+                || unclaimedStart(snake, layer, x, y));
+          }
+        }
+      }
+    }
+  }
+  hostStat("bench rounds", rounds);
+  hostStat("bench segments per snake avg", checks ? segments / (double)checks : 0);
+  hostStat("bench turns with a jump", jumpTurns);
+  hostStat("willCollide walk ns/query", walked * 1000.0 / (4.0 * queries));
+  hostStat("willCollide indexed ns/query", indexed * 1000.0 / (4.0 * queries));
+  hostStat("covers indexed ns/query", covered * 1000.0 / queries);
+  hostStat("bench mismatches", mismatches);
+  hostStat("bench bitboard vs willCollide mismatches", collideMismatches);
+  hostStat("bench checksum", hits);
+}
+#endif
+
 int main(){
+  mem_paint(); //before anything else has used the stack
   init();
   tft.initR(INITR_REDTAB); // initialize a ST7735R chip, green tab
-  Serial.begin(9600);
-  Serial2.begin(9600);
+  Serial.begin(consoleBaud);
+#ifdef HOST
+  const char *bench = getenv("SNEK_BENCH");
+  if(bench){
+    benchSegments(atoi(bench) > 0 ? atoi(bench) : 8);
+    return 0;
+  }
+#endif
   pinMode(11, INPUT); //read to identify server
   isServer = digitalRead(11);
-  GameManager* gm = new GameManager();
-  gm->run(); //play the game, once
+  for(int l = 0; l < (isServer ? CLIENTS : 1); l++){
+    (isServer ? *clientPorts[l] : Serial2).begin(linkRate(0));
+  }
+  replay_begin(SD_CS); //the card is only used for the replay
+  game.begin();
+#ifdef REPLAY
+#ifdef HOST
+  const char *playName = getenv("SNEK_REPLAY");
+  const char *recordName = getenv("SNEK_RECORD");
+#else
+  //the joystick button is active low, game.begin() set up its pull-up
+  const char *playName = digitalRead(SEL) ? NULL : replayFile;
+  const char *recordName = replayFile;
+#endif
+  if(playName && !game.playBack(playName)){
+    LOG(NO_REPLAY, 0, 0, 0);
+  }
+  if(isServer) game.record(recordName);
+#endif
+  game.run(); //play the game, once
+  profile_dump(Serial); //frame phase timings, if built with PROFILE
+  mem_report(Serial);
+  replay_report(Serial);
+#ifdef HOST
+  hostReport(game.getFrames());
+  hostStat("SPI bytes/tick", game.getSpiBytes() / (double)game.getFrames());
+  hostStat("SPI bytes/tick, one drawPixel per update",
+      game.getUnbatchedSpiBytes() / (double)game.getFrames());
+  hostStat("snakes dead", game.getDeadSnakes());
+  if(game.isReplaying()) hostStat("replay diverged ticks", game.getDiverged());
+  SyncStats &sync = game.getSync();
+  hostStat("state checks", sync.checks);
+  hostStat("state mismatches", sync.mismatches);
+  hostStat("resyncs", sync.resyncs);
+  hostStat("resync max ticks", sync.maxTicks);
+  hostStat("resync retries", sync.retries);
+  hostStat("moves coalesced", game.getMovesCoalesced());
+  hostStat("moves dropped", game.getMovesDropped());
+  hostStat("predicted ticks", game.getPredicted());
+  hostStat("rollbacks", game.getRollbacks());
+  hostStat("rollback pixels redrawn", game.getRedrawn());
+  uint32_t connectMs = 0; //until the last client was in
+  uint16_t attempts = 0;
+  uint32_t baud = 0; //of the slowest link
+  uint16_t trialsFailed = 0, fallbacks = 0, crcErrors = 0, dropped = 0;
+  uint8_t backlogMax = 0, packetsMax = 0;
+  uint16_t rxFull = 0;
+  for(int l = 0; l < game.getLinks(); l++){
+    Link &link = game.getLink(l);
+    if(link.connectMs > connectMs) connectMs = link.connectMs;
+    attempts += link.attempts;
+    if(!baud || link.baud() < baud) baud = link.baud();
+    trialsFailed += link.trialsFailed;
+    fallbacks += link.fallbacks;
+    crcErrors += game.getParser(l).crc_errors;
+    dropped += game.getParser(l).dropped;
+    RxStats &rxStats = game.getRxStats(l);
+    if(rxStats.backlogMax > backlogMax) backlogMax = rxStats.backlogMax;
+    if(rxStats.packetsMax > packetsMax) packetsMax = rxStats.packetsMax;
+    rxFull += rxStats.full;
+  }
+  hostStat("connect ms", connectMs);
+  hostStat("connect attempts", attempts);
+  hostStat("link baud", baud);
+  hostStat("link rates failed", trialsFailed);
+  hostStat("link fallbacks", fallbacks);
+  hostStat("link CRC errors", crcErrors);
+  hostStat("link bytes dropped", dropped);
+  hostStat("rx backlog max bytes", backlogMax);
+  hostStat("rx packets per drain max", packetsMax);
+  hostStat("rx ring full", rxFull);
+  Scheduler &clock = game.getClock();
+  hostStat("tick period min ms", clock.minPeriod / 1000.0);
+  hostStat("tick period avg ms", clock.avgPeriod() / 1000.0);
+  hostStat("tick period max ms", clock.maxPeriod / 1000.0);
+  hostStat("tick overruns", clock.overruns);
+  hostStat("ticks dropped", clock.dropped);
+  profile_write_trace(); //Chrome trace of the last frames, if SNEK_TRACE
+#endif
   Serial.end();
-  Serial2.end();
+  for(int l = 0; l < (isServer ? CLIENTS : 1); l++){
+    (isServer ? *clientPorts[l] : Serial2).end();
+  }
   return 0;
 }
@@ -0,0 +1,158 @@
+/*
+ * Host benchmark for lcd_image_draw.
+ *
+ * Writes 128x160 sample images in each format, then draws full screen and
+ * partial patches of them through the SD and ST7735 stand-ins, reporting
+ * image bytes/sec and the card and SPI traffic per draw.  The drawn patch
+ * is checked against the sample each time.
+ *
+ *   make lcd_bench && ./tools/lcd_bench [draws]
+ */
+
+#include <stdio.h>
+#include <time.h>
+
+#include <Adafruit_GFX.h>
+#include <Adafruit_ST7735.h>
+#include <SD.h>
+
+#include "lcd_image.h"
+#include "lcd_rle.h"
+
+#define NCOLS 128
+#define NROWS 160
+
+static char image_name[] = "lcd_bench.lcd";
+
+static uint16_t sample[NROWS][NCOLS];
+
+static double now_sec() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+// worst case for run length encoding, no two neighbours equal
+static void make_noise() {
+  for (uint32_t i = 0; i < NCOLS * NROWS; i++) {
+    sample[i / NCOLS][i % NCOLS] = i * 2654435761u >> 16;
+  }
+}
+
+// a splash screen: flat background, a framed panel, blocky lettering
+static void make_splash() {
+  for (int y = 0; y < NROWS; y++) {
+    for (int x = 0; x < NCOLS; x++) {
+      uint16_t c = 0x0010;
+      if (x >= 10 && x < 118 && y >= 40 && y < 120) {
+        bool edge = x < 12 || x >= 116 || y < 42 || y >= 118;
+        c = edge ? 0xFFFF : 0x07E0;
+        if (!edge && y >= 60 && y < 100 && (x / 6 + y / 8) % 3 == 0) {
+          c = 0xF800;
+        }
+      }
+      sample[y][x] = c;
+    }
+  }
+}
+
+// a sky: each row one colour, darkening down the screen
+static void make_gradient() {
+  for (int y = 0; y < NROWS; y++) {
+    for (int x = 0; x < NCOLS; x++) {
+      sample[y][x] = (y * 31 / NROWS) | ((63 - y * 63 / NROWS) << 5);
+    }
+  }
+}
+
+static void write_image(uint8_t format) {
+  FILE *f = fopen(image_name, "wb");
+  if (format == LCD_IMAGE_RLE) {
+    lcd_rle_write(f, &sample[0][0], NCOLS, NROWS);
+    fclose(f);
+    return;
+  }
+  if (format == LCD_IMAGE_NATIVE) {
+    lcd_image_header_t header = { {'L', 'C', 'D', 'I'}, LCD_IMAGE_VERSION,
+      LCD_IMAGE_NATIVE, NCOLS, NROWS, {0} };
+    fwrite(&header, sizeof(header), 1, f);
+  }
+  for (uint32_t i = 0; i < NCOLS * NROWS; i++) {
+    uint16_t pixel = sample[i / NCOLS][i % NCOLS];
+    if (format == LCD_IMAGE_SWAPPED) {
+      pixel = (pixel << 8) | (pixel >> 8);
+    }
+    fwrite(&pixel, 2, 1, f);
+  }
+  fclose(f);
+}
+
+static uint32_t file_size() {
+  File f = SD.open(image_name);
+  uint32_t size = f.size();
+  f.close();
+  return size;
+}
+
+static bool bench(const char *name, lcd_image_t *img, Adafruit_ST7735 *tft,
+    uint16_t icol, uint16_t irow, uint16_t width, uint16_t height,
+    int draws) {
+  uint32_t reads = SD.reads, seeks = SD.seeks, bytes_read = SD.bytesRead;
+  uint32_t spi = tft->getSpiBytes();
+  double start = now_sec();
+
+  for (int i = 0; i < draws; i++) {
+    lcd_image_draw(img, tft, icol, irow, 0, 0, width, height);
+  }
+
+  double secs = now_sec() - start;
+  double bytes = 2.0 * width * height * draws;
+  printf("  %-18s %4ux%-4u %7.1f MB/s %6.1f reads %6.1f seeks %7.0f card bytes %7.0f SPI bytes /draw\n",
+      name, width, height, bytes / secs / 1e6,
+      (SD.reads - reads) / (double) draws, (SD.seeks - seeks) / (double) draws,
+      (SD.bytesRead - bytes_read) / (double) draws,
+      (tft->getSpiBytes() - spi) / (double) draws);
+
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width; x++) {
+      if (tft->getPixel(x, y) != sample[irow + y][icol + x]) {
+        printf("  %s: pixel %d,%d differs from the sample\n", name, x, y);
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+int main(int argc, char **argv) {
+  int draws = argc > 1 ? atoi(argv[1]) : 2000;
+  Adafruit_ST7735 tft(6, 7, 8);
+  void (*samples[])() = { make_noise, make_splash, make_gradient };
+  const char *sample_names[] = { "noise", "splash", "gradient" };
+  const uint8_t formats[] = {
+    LCD_IMAGE_SWAPPED, LCD_IMAGE_NATIVE, LCD_IMAGE_RLE
+  };
+  const char *names[] = { "swapped", "native", "rle" };
+  bool ok = true;
+
+  for (int s = 0; s < 3; s++) {
+    samples[s]();
+    for (int f = 0; f < 3; f++) {
+      lcd_image_t img = { image_name, NCOLS, NROWS };
+
+      write_image(formats[f]);
+      lcd_image_read_header(&img);
+      printf("%s %s, %u bytes\n", sample_names[s], names[f], file_size());
+
+      ok &= bench("full screen", &img, &tft, 0, 0, 128, 160, draws);
+      ok &= bench("full width band", &img, &tft, 0, 40, 128, 32, draws);
+      ok &= bench("centre patch", &img, &tft, 32, 48, 64, 64, draws);
+      ok &= bench("narrow column", &img, &tft, 60, 0, 8, 160, draws);
+      ok &= bench("left column", &img, &tft, 0, 0, 8, 160, draws);
+      ok &= bench("small patch", &img, &tft, 8, 100, 16, 16, draws);
+    }
+  }
+
+  remove(image_name);
+  return ok ? 0 : 1;
+}
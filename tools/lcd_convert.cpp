@@ -0,0 +1,120 @@
+/*
+ * Converts an image for lcd_image_draw to the LCD_IMAGE_NATIVE format, or
+ * with -r to the run length encoded LCD_IMAGE_RLE format.
+ *
+ *   lcd_convert [-r] in out                 in has an lcd_image header
+ *   lcd_convert [-r] in out ncols nrows     in is a headerless image
+ *
+ * The output gets a version 1 header and its pixels in the arduino's byte
+ * order, so lcd_image_draw can push them without swapping each one.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <Adafruit_ST7735.h>
+
+#include "lcd_image.h"
+#include "lcd_rle.h"
+
+static uint16_t get16(const uint8_t *p) {
+  return p[0] | (p[1] << 8);
+}
+
+int main(int argc, char **argv) {
+  bool rle = argc > 1 && strcmp(argv[1], "-r") == 0;
+  if (rle) {
+    argc--;
+    argv++;
+  }
+  if (argc != 3 && argc != 5) {
+    fprintf(stderr, "usage: lcd_convert [-r] in out [ncols nrows]\n");
+    return 2;
+  }
+  FILE *in = fopen(argv[1], "rb");
+  if (!in) {
+    perror(argv[1]);
+    return 1;
+  }
+
+  uint8_t hdr[LCD_IMAGE_HEADER_SIZE];
+  uint16_t ncols, nrows;
+  uint8_t format = LCD_IMAGE_SWAPPED;
+
+  if (argc == 5) {
+    ncols = atoi(argv[3]);
+    nrows = atoi(argv[4]);
+  }
+  else {
+    if (fread(hdr, 1, sizeof(hdr), in) != sizeof(hdr) ||
+        memcmp(hdr, LCD_IMAGE_MAGIC, 4) != 0 ||
+        hdr[4] != LCD_IMAGE_VERSION) {
+      fprintf(stderr, "%s: no lcd_image header, give ncols and nrows\n",
+          argv[1]);
+      return 1;
+    }
+    format = hdr[5];
+    ncols = get16(hdr + 6);
+    nrows = get16(hdr + 8);
+  }
+  if (format != LCD_IMAGE_SWAPPED && format != LCD_IMAGE_NATIVE) {
+    fprintf(stderr, "%s: cannot convert format %u\n", argv[1], format);
+    return 1;
+  }
+
+  // whole image in memory, as pixel values
+  uint32_t npixels = (uint32_t) ncols * nrows;
+  uint8_t *bytes = new uint8_t[2 * npixels];
+  uint16_t *px = new uint16_t[npixels];
+  if (fread(bytes, 2, npixels, in) != npixels) {
+    fprintf(stderr, "%s: shorter than %ux%u\n", argv[1], ncols, nrows);
+    return 1;
+  }
+  fclose(in);
+  for (uint32_t i = 0; i < npixels; i++) {
+    if (format == LCD_IMAGE_SWAPPED) {
+      px[i] = (bytes[2*i] << 8) | bytes[2*i + 1];
+    }
+    else {
+      px[i] = get16(bytes + 2*i);
+    }
+  }
+
+  FILE *out = fopen(argv[2], "wb");
+  if (!out) {
+    perror(argv[2]);
+    return 1;
+  }
+  uint32_t size;
+  if (rle) {
+    size = lcd_rle_write(out, px, ncols, nrows);
+  }
+  else {
+    memset(hdr, 0, sizeof(hdr));
+    memcpy(hdr, LCD_IMAGE_MAGIC, 4);
+    hdr[4] = LCD_IMAGE_VERSION;
+    hdr[5] = LCD_IMAGE_NATIVE;
+    lcd_rle_put16(hdr + 6, ncols);
+    lcd_rle_put16(hdr + 8, nrows);
+    for (uint32_t i = 0; i < npixels; i++) {
+      lcd_rle_put16(bytes + 2*i, px[i]);
+    }
+    size = 0;
+    if (fwrite(hdr, 1, sizeof(hdr), out) == sizeof(hdr) &&
+        fwrite(bytes, 2, npixels, out) == npixels) {
+      size = sizeof(hdr) + 2 * npixels;
+    }
+  }
+  if (fclose(out) != 0 || size == 0) {
+    perror(argv[2]);
+    return 1;
+  }
+  printf("%s: %ux%u, %u bytes raw, %u bytes written\n", argv[2], ncols, nrows,
+      (unsigned) (2 * npixels), (unsigned) size);
+
+  delete[] bytes;
+  delete[] px;
+  return 0;
+}
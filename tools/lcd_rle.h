@@ -0,0 +1,97 @@
+/*
+ * Host side encoder for LCD_IMAGE_RLE images, shared by lcd_convert and
+ * lcd_bench.
+ */
+
+#ifndef _LCD_RLE_H
+#define _LCD_RLE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "lcd_image.h"
+
+static void lcd_rle_put16(uint8_t *p, uint16_t v) {
+  p[0] = v & 0xFF;
+  p[1] = v >> 8;
+}
+
+// equal pixels starting at px[i], at most LCD_IMAGE_RLE_MAX_RUN
+static uint16_t lcd_rle_same(const uint16_t *px, uint16_t n, uint16_t i) {
+  uint16_t j = i + 1;
+  while (j < n && j - i < LCD_IMAGE_RLE_MAX_RUN && px[j] == px[i]) {
+    j++;
+  }
+  return j - i;
+}
+
+/* Encodes one row of n pixels into out, which needs room for 3 * n bytes,
+ * and returns the encoded length.  Three or more equal pixels become a
+ * repeat, anything else is gathered into literals.
+ */
+static uint32_t lcd_rle_encode_row(const uint16_t *px, uint16_t n,
+    uint8_t *out) {
+  uint32_t len = 0;
+  uint16_t i = 0;
+  while (i < n) {
+    uint16_t same = lcd_rle_same(px, n, i);
+    if (same >= 3 || (same == 2 && i + 2 == n)) {
+      out[len++] = LCD_IMAGE_RLE_REPEAT | (same - 1);
+      lcd_rle_put16(out + len, px[i]);
+      len += 2;
+      i += same;
+      continue;
+    }
+    uint16_t start = i;
+    while (i < n && i - start < LCD_IMAGE_RLE_MAX_RUN &&
+        lcd_rle_same(px, n, i) < 3) {
+      i++;
+    }
+    out[len++] = i - start - 1;
+    for (uint16_t k = start; k < i; k++) {
+      lcd_rle_put16(out + len, px[k]);
+      len += 2;
+    }
+  }
+  return len;
+}
+
+/* Writes an LCD_IMAGE_RLE file for the ncols x nrows pixels px, in row
+ * order and in the host's value order.  Returns the file size, or 0 if it
+ * could not be written.
+ */
+static uint32_t lcd_rle_write(FILE *f, const uint16_t *px,
+    uint16_t ncols, uint16_t nrows) {
+  uint8_t hdr[LCD_IMAGE_HEADER_SIZE];
+  memset(hdr, 0, sizeof(hdr));
+  memcpy(hdr, LCD_IMAGE_MAGIC, 4);
+  hdr[4] = LCD_IMAGE_VERSION;
+  hdr[5] = LCD_IMAGE_RLE;
+  lcd_rle_put16(hdr + 6, ncols);
+  lcd_rle_put16(hdr + 8, nrows);
+
+  uint32_t *offsets = new uint32_t[nrows];
+  uint8_t *rows = new uint8_t[3 * (uint32_t) ncols * nrows];
+  uint32_t at = LCD_IMAGE_HEADER_SIZE + 4 * (uint32_t) nrows;
+  uint32_t len = 0;
+  for (uint16_t y = 0; y < nrows; y++) {
+    offsets[y] = at + len;
+    len += lcd_rle_encode_row(px + (uint32_t) y * ncols, ncols, rows + len);
+  }
+
+  bool ok = fwrite(hdr, 1, sizeof(hdr), f) == sizeof(hdr);
+  for (uint16_t y = 0; y < nrows && ok; y++) {
+    uint8_t b[4];
+    lcd_rle_put16(b, offsets[y] & 0xFFFF);
+    lcd_rle_put16(b + 2, offsets[y] >> 16);
+    ok = fwrite(b, 1, 4, f) == 4;
+  }
+  ok = ok && fwrite(rows, 1, len, f) == len;
+
+  delete[] offsets;
+  delete[] rows;
+  return ok ? at + len : 0;
+}
+
+#endif
@@ -0,0 +1,70 @@
+/*
+ * Turns the binary records in a console capture back into text.
+ *
+ *   log_decode [capture]       reads stdin without a capture
+ *
+ * The console's plain text passes through unchanged, and each record from
+ * log.h becomes a line of its own with its time, level and message.  Build
+ * it with the same log.h as the sketch that made the capture.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "log.h"
+
+#define LOG_FORMAT_(name, level, format) format,
+static const char *formats[LOG_IDS] = { LOG_MESSAGES(LOG_FORMAT_) };
+#define LOG_LEVEL_OF_(name, level, format) level,
+static const uint8_t levels[LOG_IDS] = { LOG_MESSAGES(LOG_LEVEL_OF_) };
+
+static const char *level_names[] = { "off", "error", "warn", "info", "debug" };
+
+static uint32_t get32(const uint8_t *p) {
+  return p[0] | (p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+int main(int argc, char **argv) {
+  if (argc > 2) {
+    fprintf(stderr, "usage: log_decode [capture]\n");
+    return 2;
+  }
+  FILE *in = argc == 2 ? fopen(argv[1], "rb") : stdin;
+  if (!in) {
+    perror(argv[1]);
+    return 1;
+  }
+
+  bool line_start = true;
+  int ch;
+  while ((ch = getc(in)) != EOF) {
+    if (ch != LOG_MAGIC) {
+      putchar(ch);
+      line_start = ch == '\n';
+      continue;
+    }
+    uint8_t f[LOG_FRAME_SIZE];
+    f[0] = ch;
+    if (fread(f + 1, 1, sizeof(f) - 1, in) != sizeof(f) - 1) {
+      fprintf(stderr, "log_decode: capture ends in a record\n");
+      return 1;
+    }
+    uint8_t id = f[1];
+    unsigned long ms = get32(f + 2);
+    unsigned long a = get32(f + 6);
+    unsigned long b = f[10] | (f[11] << 8);
+    unsigned long c = get32(f + 12);
+    // a record can land in the middle of another board's line
+    if (!line_start) putchar('\n');
+    if (id >= LOG_IDS) {
+      printf("[%10lu ms] unknown record %u: %lu %lu %lu\n", ms, id, a, b, c);
+    }
+    else {
+      printf("[%10lu ms] %s: ", ms, level_names[levels[id]]);
+      printf(formats[id], a, b, c);
+      putchar('\n');
+    }
+    line_start = true;
+  }
+  return 0;
+}